@@ -0,0 +1,360 @@
+#ifndef VNPGE_BINARY_LOADER_HEADER
+#define VNPGE_BINARY_LOADER_HEADER
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+#include "structures.h"
+#include "files.h"
+#include "loader.h"
+
+#include "character.h"
+#include "chapter.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief Layout of precompiled (".vnch") chapter files.
+ *
+ * A compiled chapter is a single flat blob, meant to be mapped into memory and read in place:
+ *
+ *     Header | CharacterRecord[] | ExpressionRecord[] | ImageRecord[] | FrameRecord[] | string table
+ *
+ * Every string (names, IDs, dialogue, paths) lives once in the string table and is referred to by a StringRef.
+ * Characters, expressions and images are referred to by their index in their respective record arrays,
+ * so nothing has to be looked up by name when the chapter is loaded.
+ * All fields are stored in native (little-endian) byte order.
+ */
+namespace binary {
+	// The format is read in place, so a big-endian host would need a byte-swapping loader
+	static_assert(std::endian::native == std::endian::little, "Compiled chapters are only supported on little-endian hosts");
+
+	constexpr char magic[4] = {'V', 'N', 'C', 'H'};
+
+	// Bump this whenever any of the record layouts below change
+	constexpr std::uint32_t formatVersion = 1;
+
+	struct StringRef {
+		public:
+		std::uint32_t offset;
+		std::uint32_t length;
+	};
+
+	struct Header {
+		public:
+		char magic[4];
+		std::uint32_t version;
+
+		StringRef chapterName;
+
+		std::uint32_t characterCount;
+		std::uint32_t expressionCount;
+		std::uint32_t imageCount;
+		std::uint32_t frameCount;
+
+		// Byte offsets from the start of the file
+		std::uint64_t charactersOffset;
+		std::uint64_t expressionsOffset;
+		std::uint64_t imagesOffset;
+		std::uint64_t framesOffset;
+		std::uint64_t stringsOffset;
+		std::uint64_t stringsSize;
+	};
+
+	struct CharacterRecord {
+		public:
+		StringRef id;
+		StringRef name;
+
+		// This character's expressions are the ExpressionRecords [firstExpression, firstExpression + expressionCount)
+		std::uint32_t firstExpression;
+		std::uint32_t expressionCount;
+	};
+
+	struct ExpressionRecord {
+		public:
+		StringRef name;
+		std::uint32_t image;
+	};
+
+	struct ImageRecord {
+		public:
+		StringRef path;
+	};
+
+	struct FrameRecord {
+		public:
+		PositionMapping position;
+		StringRef dialogue;
+
+		std::uint32_t character;
+		// Index into the ExpressionRecords, not relative to the character's own expressions
+		std::uint32_t expression;
+		std::uint32_t background;
+		std::uint32_t reserved;
+	};
+
+
+	/**
+	 * @brief Compile a parsed chapter into the binary chapter format.
+	 * Resolves every character, expression and background reference up front, so a compiled chapter can't contain dangling IDs.
+	 *
+	 * @param chapter The parsed chapter, as produced by e.g. JSONLoader::parseChapter.
+	 * @param outPath Path of the compiled chapter file to write.
+	 */
+	inline void writeChapter(const MetaChapter& chapter, const std::string& outPath) {
+		std::string strings;
+		std::unordered_map<std::string, StringRef> stringMap;
+
+		// Identical strings (IDs, paths, repeated lines) are only stored once
+		auto addString = [&strings, &stringMap](const std::string& s) -> StringRef {
+			if (auto it = stringMap.find(s); it != stringMap.end()) {
+				return it->second;
+			}
+			StringRef ref = {static_cast<std::uint32_t>(strings.size()), static_cast<std::uint32_t>(s.size())};
+			strings.append(s);
+			stringMap.emplace(s, ref);
+			return ref;
+		};
+
+		std::vector<ImageRecord> images;
+		std::unordered_map<std::string, std::uint32_t> imageMap;
+
+		auto addImage = [&images, &imageMap, &addString](const std::string& path) -> std::uint32_t {
+			if (auto it = imageMap.find(path); it != imageMap.end()) {
+				return it->second;
+			}
+			auto index = static_cast<std::uint32_t>(images.size());
+			images.push_back({addString(path)});
+			imageMap.emplace(path, index);
+			return index;
+		};
+
+		std::vector<CharacterRecord> characters;
+		std::vector<ExpressionRecord> expressions;
+
+		// Both maps are keyed on character index + expression name, to keep the same expression name on different characters apart
+		std::unordered_map<std::string, std::uint32_t> characterMap;
+		std::vector<std::unordered_map<std::string, std::uint32_t>> expressionMaps;
+
+		for (auto& metaCharacter : chapter.metaCharacters) {
+			CharacterRecord record = {
+				.id = addString(metaCharacter.id),
+				.name = addString(metaCharacter.name),
+				.firstExpression = static_cast<std::uint32_t>(expressions.size()),
+				.expressionCount = static_cast<std::uint32_t>(metaCharacter.metaExpressions.size())
+			};
+
+			auto& expressionMap = expressionMaps.emplace_back();
+			for (auto& metaExpression : metaCharacter.metaExpressions) {
+				expressionMap.emplace(metaExpression.first, static_cast<std::uint32_t>(expressions.size()));
+				expressions.push_back({addString(metaExpression.first), addImage(metaExpression.second)});
+			}
+
+			characterMap.emplace(metaCharacter.id, static_cast<std::uint32_t>(characters.size()));
+			characters.push_back(record);
+		}
+
+		std::vector<FrameRecord> frames;
+		frames.reserve(chapter.metaFrames.size());
+		for (auto& metaFrame : chapter.metaFrames) {
+			auto charIt = characterMap.find(metaFrame.characterID);
+			if (charIt == characterMap.end()) {
+				throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + metaFrame.characterID + "' doesn't exist.\033[37m");
+			}
+
+			auto& expressionMap = expressionMaps[charIt->second];
+			auto expIt = expressionMap.find(metaFrame.expression);
+			if (expIt == expressionMap.end()) {
+				throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + metaFrame.characterID + "' has no expression '" + metaFrame.expression + "'.\033[37m");
+			}
+
+			frames.push_back({
+				.position = metaFrame.position,
+				.dialogue = addString(metaFrame.textDialogue),
+				.character = charIt->second,
+				.expression = expIt->second,
+				.background = addImage(metaFrame.bg),
+				.reserved = 0
+			});
+		}
+
+		Header header = {
+			.magic = {magic[0], magic[1], magic[2], magic[3]},
+			.version = formatVersion,
+			.chapterName = addString(chapter.chapterName),
+			.characterCount = static_cast<std::uint32_t>(characters.size()),
+			.expressionCount = static_cast<std::uint32_t>(expressions.size()),
+			.imageCount = static_cast<std::uint32_t>(images.size()),
+			.frameCount = static_cast<std::uint32_t>(frames.size()),
+			.charactersOffset = 0,
+			.expressionsOffset = 0,
+			.imagesOffset = 0,
+			.framesOffset = 0,
+			.stringsOffset = 0,
+			.stringsSize = strings.size()
+		};
+
+		// Lay the sections out back to back, keeping each one aligned for its record type
+		auto alignUp = [](std::uint64_t offset, std::uint64_t alignment) {
+			return (offset + alignment - 1) / alignment * alignment;
+		};
+
+		header.charactersOffset  = alignUp(sizeof(Header), alignof(CharacterRecord));
+		header.expressionsOffset = alignUp(header.charactersOffset  + characters.size()  * sizeof(CharacterRecord),  alignof(ExpressionRecord));
+		header.imagesOffset      = alignUp(header.expressionsOffset + expressions.size() * sizeof(ExpressionRecord), alignof(ImageRecord));
+		header.framesOffset      = alignUp(header.imagesOffset      + images.size()      * sizeof(ImageRecord),      alignof(FrameRecord));
+		header.stringsOffset     = header.framesOffset + frames.size() * sizeof(FrameRecord);
+
+		std::vector<char> blob(header.stringsOffset + strings.size(), 0);
+
+		std::memcpy(blob.data(), &header, sizeof(Header));
+		std::memcpy(blob.data() + header.charactersOffset,  characters.data(),  characters.size()  * sizeof(CharacterRecord));
+		std::memcpy(blob.data() + header.expressionsOffset, expressions.data(), expressions.size() * sizeof(ExpressionRecord));
+		std::memcpy(blob.data() + header.imagesOffset,      images.data(),      images.size()      * sizeof(ImageRecord));
+		std::memcpy(blob.data() + header.framesOffset,      frames.data(),      frames.size()      * sizeof(FrameRecord));
+		std::memcpy(blob.data() + header.stringsOffset,     strings.data(),     strings.size());
+
+		std::ofstream file{outPath, std::ios::out | std::ios::binary | std::ios::trunc};
+		file.write(blob.data(), blob.size());
+		if (!file) {
+			throw std::runtime_error("Could not write compiled chapter to " + outPath);
+		}
+	}
+}
+
+
+class BinaryLoader : public ChapterLoader {
+	private:
+	/**
+	 * @brief Find and bounds-check a record array inside a mapped chapter file.
+	 */
+	template <typename Record>
+	static const Record* getRecords(const MappedFile& file, std::uint64_t offset, std::uint32_t count) {
+		if (offset % alignof(Record) != 0 || offset > file.size() || count > (file.size() - offset) / sizeof(Record)) {
+			throw std::runtime_error("Compiled chapter is truncated or corrupt!");
+		}
+		return reinterpret_cast<const Record*>(file.data() + offset);
+	}
+
+	public:
+	BinaryLoader(std::vector<std::string> paths) : ChapterLoader(paths) {
+		if (this->paths.size() < 1) {
+			throw std::runtime_error("No paths to compiled chapter files were specified!");
+		}
+	}
+
+	using ChapterLoader::loadChapter;
+
+	Chapter loadChapter(const std::string& path) override {
+		MappedFile file{path};
+
+		if (file.size() < sizeof(binary::Header)) {
+			throw std::runtime_error("File is too small to be a compiled chapter: " + path);
+		}
+
+		binary::Header header;
+		std::memcpy(&header, file.data(), sizeof(binary::Header));
+
+		if (std::memcmp(header.magic, binary::magic, sizeof(binary::magic)) != 0) {
+			throw std::runtime_error("Not a compiled chapter file: " + path);
+		}
+		if (header.version != binary::formatVersion) {
+			throw std::runtime_error("Compiled chapter " + path + " has format version " + std::to_string(header.version) +
+									 ", but this build reads version " + std::to_string(binary::formatVersion) + ". Recompile it.");
+		}
+		if (header.stringsOffset > file.size() || header.stringsSize > file.size() - header.stringsOffset) {
+			throw std::runtime_error("Compiled chapter is truncated or corrupt!");
+		}
+
+		auto characters  = getRecords<binary::CharacterRecord>(file, header.charactersOffset, header.characterCount);
+		auto expressions = getRecords<binary::ExpressionRecord>(file, header.expressionsOffset, header.expressionCount);
+		auto images      = getRecords<binary::ImageRecord>(file, header.imagesOffset, header.imageCount);
+		auto frames      = getRecords<binary::FrameRecord>(file, header.framesOffset, header.frameCount);
+
+		std::string_view strings = file.view().substr(header.stringsOffset, header.stringsSize);
+
+		auto getString = [&strings](binary::StringRef ref) -> std::string_view {
+			if (ref.offset > strings.size() || ref.length > strings.size() - ref.offset) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds string!");
+			}
+			return strings.substr(ref.offset, ref.length);
+		};
+
+		auto getImagePath = [&](std::uint32_t index) -> std::string_view {
+			if (index >= header.imageCount) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds image reference!");
+			}
+			return getString(images[index].path);
+		};
+
+		// Characters are few, so they still go through MetaCharacters; frames are written straight into the Chapter below
+		std::vector<MetaCharacter> metaCharacters;
+		metaCharacters.reserve(header.characterCount);
+		for (std::uint32_t i = 0; i < header.characterCount; i++) {
+			auto& character = characters[i];
+			if (character.firstExpression > header.expressionCount || character.expressionCount > header.expressionCount - character.firstExpression) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds expression range!");
+			}
+
+			std::unordered_map<std::string, std::string> metaExpressions;
+			metaExpressions.reserve(character.expressionCount);
+			for (std::uint32_t e = character.firstExpression; e < character.firstExpression + character.expressionCount; e++) {
+				metaExpressions.emplace(getString(expressions[e].name), getImagePath(expressions[e].image));
+			}
+
+			metaCharacters.emplace_back(std::string{getString(character.name)}, metaExpressions, std::string{getString(character.id)});
+		}
+
+		// Character handles are handed out in definition order, so a character's record index is also its CharacterID
+		Chapter chapter{std::string{getString(header.chapterName)}, metaCharacters};
+
+		// Translate the file's image and expression indices into the Chapter's image handles once, rather than per frame
+		std::vector<ImageID> imageIDs(header.imageCount);
+		for (std::uint32_t i = 0; i < header.imageCount; i++) {
+			imageIDs[i] = chapter.internImage(getImagePath(i));
+		}
+
+		std::vector<ImageID> expressionImageIDs(header.expressionCount);
+		for (std::uint32_t e = 0; e < header.expressionCount; e++) {
+			if (expressions[e].image >= header.imageCount) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds image reference!");
+			}
+			expressionImageIDs[e] = imageIDs[expressions[e].image];
+		}
+
+		// Lengths are checked against the strings section before any of them are trusted with an allocation
+		std::size_t dialogueBytes = 0;
+		for (std::uint32_t i = 0; i < header.frameCount; i++) {
+			dialogueBytes += getString(frames[i].dialogue).size();
+		}
+		chapter.storyFrames.reserve(header.frameCount, dialogueBytes);
+
+		for (std::uint32_t i = 0; i < header.frameCount; i++) {
+			auto& frame = frames[i];
+			if (frame.character >= header.characterCount || frame.background >= header.imageCount) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds frame reference!");
+			}
+
+			// The expression has to be one of the speaking character's own
+			auto& character = characters[frame.character];
+			if (frame.expression < character.firstExpression || frame.expression - character.firstExpression >= character.expressionCount) {
+				throw std::runtime_error("Compiled chapter contains an out of bounds frame reference!");
+			}
+
+			chapter.storyFrames.push_back(getString(frame.dialogue), frame.character, expressionImageIDs[frame.expression], imageIDs[frame.background], frame.position);
+		}
+
+		return chapter;
+	}
+};
+}
+#endif
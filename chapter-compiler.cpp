@@ -0,0 +1,42 @@
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <chrono>
+
+#include "chapter.h"
+#include "json-loader.h"
+#include "binary-loader.h"
+
+
+// Offline chapter compiler
+// Turns a JSON chapter script into the precompiled binary format read by BinaryLoader, so the game doesn't have to parse JSON at startup.
+// Usage: vnpge-chapterc <chapter.json> <chapter.vnch>
+
+using namespace vnpge;
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <chapter.json> <chapter.vnch>" << std::endl;
+		return 1;
+	}
+
+	std::string inPath = argv[1];
+	std::string outPath = argv[2];
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+
+		MetaChapter chapter = JSONLoader::parseChapter(inPath);
+		binary::writeChapter(chapter, outPath);
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Compiled '" << chapter.chapterName << "' (" << chapter.metaCharacters.size() << " characters, "
+				  << chapter.metaFrames.size() << " frames) to " << outPath << " in " << ms << " ms" << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Could not compile " << inPath << ": " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
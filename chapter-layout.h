@@ -0,0 +1,232 @@
+#ifndef VNPGE_CHAPTER_LAYOUT_HEADER
+#define VNPGE_CHAPTER_LAYOUT_HEADER
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "structures.h"
+#include "frame-store.h"
+#include "text-arena.h"
+#include "text-layout.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief Line breaks of every frame's dialogue in a chapter, for one font and wrap width.
+ * Worked out all at once, in parallel, so changing frames never has to run the line breaker;
+ * renderers only place glyphs on the lines they're given.
+ * Line starts for all frames share one buffer, indexed by frame like the FrameStore's columns.
+ */
+class ChapterLayout {
+	private:
+	std::string fontKey;
+	float wrapWidth;
+	float lineHeight;
+
+	// Each frame's range of lineStartPool
+	std::vector<TextSpan> frameLines;
+	std::vector<std::uint32_t> lineStartPool;
+
+	bool complete = true;
+
+	public:
+	/**
+	 * @brief Lay out every frame's dialogue.
+	 * Each worker thread pulls the next frame until all are done. If any frame fails,
+	 * the first failure is rethrown once all workers have finished.
+	 *
+	 * @param frames Frames whose dialogue to lay out; only read, so the render thread may keep using them meanwhile.
+	 * @param metrics Measurements of the font; shared by the workers, so its measuring functions must tolerate that.
+	 * @param fontKey Identifies the font and size the metrics came from, for matches().
+	 * @param stop Abandons the layout part way if requested, leaving it incomplete.
+	 * @param threadCount Number of worker threads; 0 means one per hardware thread.
+	 */
+	ChapterLayout(const FrameStore& frames, AdvanceTable& metrics, std::string fontKey, float wrapWidth,
+	              std::stop_token stop = {}, uint threadCount = 0)
+	: fontKey{std::move(fontKey)}, wrapWidth{wrapWidth}, lineHeight{metrics.getLineHeight()} {
+		if (frames.empty()) {
+			return;
+		}
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threadCount = std::min(threadCount, static_cast<uint>(frames.size()));
+
+		std::span<const TextSpan> dialogue = frames.dialogue();
+		const TextArena& arena = frames.dialogueText();
+
+		std::vector<std::vector<std::uint32_t>> results(frames.size());
+		std::vector<std::exception_ptr> errors(frames.size());
+		std::atomic<std::size_t> nextFrame = 0;
+
+		auto worker = [&]() {
+			for (std::size_t i = nextFrame++; i < dialogue.size() && !stop.stop_requested(); i = nextFrame++) {
+				try {
+					results[i] = layoutParagraph(arena.view(dialogue[i]), metrics, wrapWidth).lineStarts;
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		{
+			std::vector<std::jthread> workers;
+			workers.reserve(threadCount);
+			for (uint t = 0; t < threadCount; t++) {
+				workers.emplace_back(worker);
+			}
+		}
+
+		for (auto& error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		if (stop.stop_requested()) {
+			complete = false;
+			return;
+		}
+
+		std::size_t total = 0;
+		for (const auto& lines : results) {
+			total += lines.size();
+		}
+		frameLines.reserve(results.size());
+		lineStartPool.reserve(total);
+		for (const auto& lines : results) {
+			frameLines.push_back({static_cast<std::uint32_t>(lineStartPool.size()), static_cast<std::uint32_t>(lines.size())});
+			lineStartPool.insert(lineStartPool.end(), lines.begin(), lines.end());
+		}
+	}
+
+	/**
+	 * @brief Whether every frame was laid out, rather than the layout being stopped part way.
+	 */
+	bool isComplete() const {
+		return complete;
+	}
+
+	/**
+	 * @brief Whether this layout is still good for text drawn in the given font and width.
+	 */
+	bool matches(const std::string& key, float width) const {
+		return complete && fontKey == key && wrapWidth == width;
+	}
+
+	/**
+	 * @brief Byte offset at which each line of a frame's dialogue starts, the first one included.
+	 */
+	std::span<const std::uint32_t> lineStarts(std::size_t frame) const {
+		TextSpan lines = frameLines[frame];
+		return std::span<const std::uint32_t>{lineStartPool}.subspan(lines.offset, lines.length);
+	}
+
+	std::size_t lineCount(std::size_t frame) const {
+		return frameLines[frame].length;
+	}
+
+	float height(std::size_t frame) const {
+		return lineCount(frame) * lineHeight;
+	}
+
+	std::size_t frameCount() const {
+		return frameLines.size();
+	}
+};
+
+
+/**
+ * @brief Builds a ChapterLayout on a background thread, so that laying out a whole chapter,
+ * after loading or a resize, never holds up the render thread.
+ * The render thread polls take() for the result; starting over abandons any layout still in progress.
+ */
+class ChapterLayoutJob {
+	private:
+	std::mutex mutex;
+	std::shared_ptr<const ChapterLayout> result;
+	std::exception_ptr error;
+	// Started, and not yet taken
+	bool pending = false;
+
+	// Declared last, so it's joined before anything it uses is destroyed
+	std::jthread worker;
+
+	public:
+	ChapterLayoutJob() = default;
+
+	ChapterLayoutJob(const ChapterLayoutJob&) = delete;
+
+	/**
+	 * @brief Start laying out a chapter's frames, abandoning any layout already under way.
+	 *
+	 * @param frames Must outlive the job, or the next start().
+	 * @param metrics Measurements of the font, owned by the job from here on.
+	 *   They'll be used from worker threads, so they shouldn't measure through a font the render thread is using.
+	 */
+	void start(const FrameStore& frames, std::shared_ptr<AdvanceTable> metrics, std::string fontKey, float wrapWidth) {
+		// Stops and joins the old worker; it checks in between frames, so this doesn't wait for the whole chapter
+		worker = {};
+		{
+			std::lock_guard lock{mutex};
+			result.reset();
+			error = nullptr;
+			pending = true;
+		}
+
+		worker = std::jthread{[this, &frames, metrics = std::move(metrics), fontKey = std::move(fontKey), wrapWidth](std::stop_token stop) {
+			try {
+				auto layout = std::make_shared<const ChapterLayout>(frames, *metrics, fontKey, wrapWidth, stop);
+				if (layout->isComplete()) {
+					std::lock_guard lock{mutex};
+					result = std::move(layout);
+				}
+			}
+			catch (...) {
+				std::lock_guard lock{mutex};
+				error = std::current_exception();
+			}
+		}};
+	}
+
+	/**
+	 * @brief Take the finished layout, if there is one. Rethrows anything the layout threw.
+	 *
+	 * @return The layout, or nullptr if it isn't done yet (or has already been taken).
+	 */
+	std::shared_ptr<const ChapterLayout> take() {
+		std::lock_guard lock{mutex};
+		if (error) {
+			pending = false;
+			std::rethrow_exception(std::exchange(error, nullptr));
+		}
+		if (result) {
+			pending = false;
+		}
+		return std::move(result);
+	}
+
+	/**
+	 * @brief Whether a layout has been started but not yet taken.
+	 * An event-driven loop should wake up now and then while this holds, to take it.
+	 */
+	bool busy() {
+		std::lock_guard lock{mutex};
+		return pending;
+	}
+};
+
+}
+#endif
@@ -1,4 +1,3 @@
-
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -7,125 +6,92 @@
 #include "structures.h"
 
 #include "image.h"
+#include "intern.h"
 #include "character.h"
+#include "chapter.h"
 
 
 namespace vnpge {
 
-/**
- * @brief Template for creating Frames.
- *  NOTE: Requires a meta-character template to construct
- */
-struct MetaFrame {
-	public:
-		std::string textDialogue;
-		std::string characterID;
-		std::string expression;
-		PositionMapping position;
-		std::string bg;
-		
-	public:
-		/**
-		 * @brief Construct a new MetaFrame object
-		 * 
-		 * @param dialogue Textual dialogue the character will be speaking in this story frame.
-		 * @param character MetaCharacter whose ID this MetaFrame will bind to.
-		 * @param exp String uniquely identifying expression the story character will have.
-		 * @param imgURL Path to background image.
-		 */
-		MetaFrame(std::string dialogue, MetaCharacter& character, std::string exp, const PositionMapping& posMap, std::string imgURL) 
-		: textDialogue{dialogue}, characterID{character.id}, expression{exp}, position(posMap), bg(imgURL) {
+	MetaFrame::MetaFrame(std::string dialogue, MetaCharacter& character, std::string exp, const PositionMapping& posMap, std::string imgURL) 
+	: textDialogue{std::move(dialogue)}, characterID{character.id}, expression{std::move(exp)}, position(posMap), bg(std::move(imgURL)) {
+	}
+
+	MetaFrame::MetaFrame(std::string dialogue, std::string characterID, std::string exp, const PositionMapping& posMap, std::string imgURL) 
+	: textDialogue{std::move(dialogue)}, characterID{std::move(characterID)}, expression{std::move(exp)}, position(posMap), bg(std::move(imgURL)) {
+	}
+
+
+	Chapter::Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters) 
+	: chapterName{std::move(name)} {
+		storyCharacters.reserve(metaCharacters.size());
+		for (auto& metaChar : metaCharacters) {
+			// Character handles double as indices into storyCharacters, so they have to be handed out in order
+			if (characterIDs.intern(metaChar.id) != storyCharacters.size()) {
+				throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + metaChar.id + "' is defined more than once.\033[37m");
+			}
+			storyCharacters.emplace_back(metaChar, expressionNames, imagePaths);
 		}
-		MetaFrame(std::string dialogue, std::string characterID, std::string exp, const PositionMapping& posMap, std::string imgURL) 
-		: textDialogue{dialogue}, characterID{characterID}, expression{exp}, position(posMap), bg(imgURL) {
+
+		// The characters interned their expression images straight into imagePaths
+		images.reserve(imagePaths.size());
+		for (ImageID id = 0; id < imagePaths.size(); id++) {
+			images.emplace_back(imagePaths[id]);
 		}
 
+		curFrame = storyFrames.begin();
+	};
 
-		MetaFrame() = delete;
-};
-/**
- * @brief A representation of an instant or moment in the story.
- * NOTE: Requires a meta-frame to construct.
- */
-struct Frame {
-	public:
-		std::string textDialogue;
-		Character& storyCharacter;
-		std::string expression;
-		PositionMapping position;
-
-		Image bg;
-	public:
-	/**
-	 * @brief Construct a new Frame
-	 * 
-	 * @param metaFrame The template for the Frame.
-	 * @param character A reference to the current Character.
-	 * @param img The image to use as a background.
-	 */
-		Frame(const MetaFrame& metaFrame, Character& character, Image& img) 
-		: textDialogue(metaFrame.textDialogue), storyCharacter(character), expression(metaFrame.expression), position(metaFrame.position), bg{img} {};
-
-		Frame() = delete;
-};
+	Chapter::Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters, const std::vector<MetaFrame>& metaFrames) 
+	: Chapter(std::move(name), metaCharacters) {
+		// Size the dialogue arena up front, so it's filled in one go and never reallocates
+		std::size_t dialogueBytes = 0;
+		for (auto& metaFrame : metaFrames) {
+			dialogueBytes += metaFrame.textDialogue.size();
+		}
+		storyFrames.reserve(metaFrames.size(), dialogueBytes);
 
-// TODO: Write up a good summary of the Chapter organisatorial structure.
-class Chapter {
-	private:
-	static const std::vector<Character> demetaCharacterVec(const std::vector<MetaCharacter>& metaCharacters) {
-		std::vector<Character> createdCharacters;
-		createdCharacters.reserve(metaCharacters.size());
-		
-		for (auto& metaChar : metaCharacters) {
-			createdCharacters.push_back({metaChar});
+		for (auto& metaFrame : metaFrames) {
+			addFrame(metaFrame.textDialogue, metaFrame.characterID, metaFrame.expression, metaFrame.bg, metaFrame.position);
 		}
-		
-		return createdCharacters;
+	};
+
+	void Chapter::addFrame(std::string_view textDialogue, std::string_view characterID, std::string_view expression, std::string_view background, const PositionMapping& position) {
+		auto charID = characterIDs.find(characterID);
+		if (!charID) {
+			throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + std::string{characterID} + "' doesn't exist.\033[37m");
+		}
+
+		// Resolve the expression now, rather than finding out it's missing when the frame is first shown
+		auto& expressions = storyCharacters[*charID].expressions;
+		auto expressionName = expressionNames.find(expression);
+		auto found = expressionName ? expressions.find(*expressionName) : expressions.end();
+		if (found == expressions.end()) {
+			throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + std::string{characterID} + "' has no expression '" + std::string{expression} + "'.\033[37m");
+		}
+
+		storyFrames.push_back(textDialogue, *charID, found->second, internImage(background), position);
 	}
-	public:
-		std::string chapterName;
-		std::vector<Character> storyCharacters;
-		std::vector<Frame> storyFrames;
-		std::vector<Image> backgrounds;
-
-		std::vector<Frame>::iterator curFrame;
-	public:
-		Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters, const std::vector<MetaFrame> metaFrames) 
-		: chapterName{name}, storyCharacters{demetaCharacterVec(metaCharacters)} {
-			storyFrames.reserve(metaFrames.size());
-			
-			std::unordered_map<std::string, Character&> charIDToRefMap;
-			std::unordered_map<std::string, Image&> bgPathtoImageMap;
-			
-			{
-				std::vector<Character>::iterator it1 = storyCharacters.begin();
-				for (auto& metaChar : metaCharacters) {
-					charIDToRefMap.insert({metaChar.id, *it1});
-					it1 = std::next(it1);
-					
-				}
-			}
-			
-			for (auto& metaFrame : metaFrames) {
-				if (charIDToRefMap.count(metaFrame.characterID)) {
-					
-					if (!bgPathtoImageMap.count(metaFrame.bg)) {
-						bgPathtoImageMap.insert({metaFrame.bg, backgrounds.emplace_back(metaFrame.bg)});
-					}
-					
-					storyFrames.emplace_back(metaFrame, charIDToRefMap.at(metaFrame.characterID), bgPathtoImageMap.at(metaFrame.bg));
-				}
-				else {
-					throw std::runtime_error("\033[1m\033[31mFatal error: Character ID '" + metaFrame.characterID + "' doesn't exist.\033[37m");
-				}
-				
-			}
-			
-			curFrame = storyFrames.begin();	
-		};
+
+	ImageID Chapter::internImage(std::string_view path) {
+		ImageID id = imagePaths.intern(path);
+		if (id == images.size()) {
+			images.emplace_back(imagePaths[id]);
+		}
+		return id;
+	}
+
+	Chapter::Chapter(Chapter&& c) noexcept 
+	: chapterName{std::move(c.chapterName)}, characterIDs{std::move(c.characterIDs)}, expressionNames{std::move(c.expressionNames)},
+	  imagePaths{std::move(c.imagePaths)}, storyCharacters{std::move(c.storyCharacters)}, images{std::move(c.images)},
+	  dialogueLayout{std::move(c.dialogueLayout)} {
+		auto frameIndex = c.curFrame - c.storyFrames.begin();
+		storyFrames = std::move(c.storyFrames);
+		curFrame = storyFrames.begin() + frameIndex;
+	};
 
 	
-	std::vector<Frame>::iterator nextFrame() {
+	FrameStore::iterator Chapter::nextFrame() {
 		if (curFrame != storyFrames.end()) {
 			curFrame = std::next(curFrame);
 		}
@@ -137,13 +103,11 @@ class Chapter {
 		return curFrame;
 	}
 
-	std::vector<Frame>::iterator prevFrame() {
+	FrameStore::iterator Chapter::prevFrame() {
 		if (curFrame != storyFrames.begin()) {
 			curFrame = std::prev(curFrame);
 			//textBox.generateDisplayText(curFrame->textDialogue);
 		}
 		return curFrame;
 	}
-	
-};
 };
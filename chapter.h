@@ -1,19 +1,25 @@
 #ifndef VNPGE_CHAPTER_HEADER
 #define VNPGE_CHAPTER_HEADER
 
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <unordered_map>
 
 #include "structures.h"
 
 #include "image.h"
+#include "intern.h"
 #include "character.h"
+#include "frame-store.h"
 
 
 namespace vnpge {
 
+class ChapterLayout;
+
 /**
  * @brief Template for creating Frames.
  *  NOTE: Requires a meta-character template to construct
@@ -42,51 +48,79 @@ struct MetaFrame {
 
 		MetaFrame() = delete;
 };
+
 /**
- * @brief A representation of an instant or moment in the story.
- * NOTE: Requires a meta-frame to construct.
+ * @brief Everything a loader extracts from a chapter script, before any of it is bound together into a Chapter.
  */
-struct Frame {
-	public:
-		std::string textDialogue;
-		Character& storyCharacter;
-		std::string expression;
-		PositionMapping position;
-
-		Image bg;
+struct MetaChapter {
 	public:
-	/**
-	 * @brief Construct a new Frame
-	 * 
-	 * @param metaFrame The template for the Frame.
-	 * @param character A reference to the current Character.
-	 * @param img The image to use as a background.
-	 */
-		Frame(const MetaFrame& metaFrame, Character& character, Image& img);
-
-		Frame() = delete;
+		std::string chapterName;
+		std::vector<MetaCharacter> metaCharacters;
+		std::vector<MetaFrame> metaFrames;
 };
 
-// TODO: Write up a good summary of the Chapter organisatorial structure.
+/**
+ * @brief A loaded chapter: its characters, images and frames.
+ * Character IDs, expression names and image paths are interned when the chapter is built.
+ * A handle from characterIDs indexes storyCharacters, and a handle from imagePaths indexes images,
+ * so looking anything up while playing is plain array indexing.
+ * The frames themselves are kept column-wise in a FrameStore.
+ */
 class Chapter {
-	private:
-	static const std::vector<Character> demetaCharacterVec(const std::vector<MetaCharacter>& metaCharacters);
-
 	public:
 		std::string chapterName;
+
+		InternTable characterIDs;
+		InternTable expressionNames;
+		InternTable imagePaths;
+
 		std::vector<Character> storyCharacters;
-		std::vector<Frame> storyFrames;
-		std::vector<Image> backgrounds;
+		std::vector<Image> images;
+		FrameStore storyFrames;
+
+		FrameStore::iterator curFrame;
 
-		std::vector<Frame>::iterator curFrame;
+		// Line breaks of every frame's dialogue, once they've been worked out for the current font and window size; may be null
+		std::shared_ptr<const ChapterLayout> dialogueLayout;
         
 	public:
-		Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters, const std::vector<MetaFrame> metaFrames);
+		Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters, const std::vector<MetaFrame>& metaFrames);
+
+		/**
+		 * @brief Construct a Chapter with characters, but no frames yet.
+		 * For loaders that fill storyFrames directly; reserve the frames and their dialogue first.
+		 */
+		Chapter(std::string name, const std::vector<MetaCharacter>& metaCharacters);
+
+		// curFrame refers to this Chapter's own FrameStore, so moving has to re-point it at the new one
+		Chapter(Chapter&& c) noexcept;
+
+	/**
+	 * @brief Get the handle for an image path, adding the image to the chapter if it's new.
+	 */
+	ImageID internImage(std::string_view path);
+
+	/**
+	 * @brief Append a frame, resolving its character, expression and background.
+	 * Throws std::runtime_error if the character doesn't exist or has no such expression.
+	 */
+	void addFrame(std::string_view textDialogue, std::string_view characterID, std::string_view expression, std::string_view background, const PositionMapping& position);
+
+	Character& getCharacter(const Frame& frame) {
+		return storyCharacters[frame.character];
+	}
+
+	Image& getExpression(const Frame& frame) {
+		return images[frame.expression];
+	}
 
+	Image& getBackground(const Frame& frame) {
+		return images[frame.background];
+	}
 	
-	std::vector<Frame>::iterator nextFrame();
+	FrameStore::iterator nextFrame();
 
-	std::vector<Frame>::iterator prevFrame();
+	FrameStore::iterator prevFrame();
 	
 };
 };
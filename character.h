@@ -6,6 +6,7 @@
 #include <unordered_map>
 
 #include "image.h"
+#include "intern.h"
 
 
 namespace vnpge {
@@ -48,14 +49,17 @@ class Character {
 
 		std::string name;
 		
-		std::unordered_map<std::string, Image> expressions;
+		// Maps interned expression names to interned image paths, both handles into the owning Chapter's tables
+		std::unordered_map<InternID, InternID> expressions;
 	public:
 	/**
 	 * @brief Construct a new Character.
 	 * 
 	 * @param metaCharacter The MetaCharacter template from which the name and expressions will be drawn
+	 * @param expressionNames Table to intern the character's expression names into.
+	 * @param imagePaths Table to intern the character's expression image paths into.
 	 */
-		Character(const MetaCharacter& metaCharacter);
+		Character(const MetaCharacter& metaCharacter, InternTable& expressionNames, InternTable& imagePaths);
 		Character() = delete;
 };
 };
@@ -0,0 +1,92 @@
+#ifndef VNPGE_DAMAGE_HEADER
+#define VNPGE_DAMAGE_HEADER
+
+#include "structures.h"
+#include "frame-store.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief The separately redrawable parts of the screen, from back to front.
+ */
+enum struct Layer : uint {
+	background = 1 << 0,
+	character = 1 << 1,
+	// The box behind the dialogue; only changes with the window size
+	textbox = 1 << 2,
+	// The dialogue itself, which has to be rasterised again when it changes
+	text = 1 << 3,
+	// Which lines of the dialogue are showing
+	textScroll = 1 << 4
+};
+
+/**
+ * @brief Set of layers that have changed since the screen was last presented.
+ * Events mark what they affect, and the renderer only recomposes those layers, skipping the frame entirely if nothing is marked.
+ */
+class Damage {
+	private:
+	uint layers = 0;
+
+	public:
+	Damage() = default;
+
+	static Damage all() {
+		Damage d;
+		d.mark(Layer::background);
+		d.mark(Layer::character);
+		d.mark(Layer::textbox);
+		d.mark(Layer::text);
+		d.mark(Layer::textScroll);
+		return d;
+	}
+
+	/**
+	 * @brief Work out which layers differ between two frames, so that moving between frames
+	 * that share a background (say) doesn't redraw it.
+	 */
+	static Damage betweenFrames(const Frame& before, const Frame& after) {
+		Damage d;
+		if (before.background != after.background) {
+			d.mark(Layer::background);
+		}
+
+		const PositionMapping& a = before.position;
+		const PositionMapping& b = after.position;
+		bool moved = a.srcPos.x != b.srcPos.x || a.srcPos.y != b.srcPos.y || a.destPos.x != b.destPos.x || a.destPos.y != b.destPos.y;
+		if (before.expression != after.expression || moved) {
+			d.mark(Layer::character);
+		}
+
+		if (before.character != after.character || before.textDialogue != after.textDialogue) {
+			d.mark(Layer::text);
+		}
+		// Changing frames always resets the scroll
+		d.mark(Layer::textScroll);
+		return d;
+	}
+
+	void mark(Layer layer) {
+		layers |= static_cast<uint>(layer);
+	}
+
+	void mark(Damage other) {
+		layers |= other.layers;
+	}
+
+	bool has(Layer layer) const {
+		return layers & static_cast<uint>(layer);
+	}
+
+	bool any() const {
+		return layers != 0;
+	}
+
+	void clear() {
+		layers = 0;
+	}
+};
+
+}
+#endif
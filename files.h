@@ -2,17 +2,30 @@
 #define FILE_MANIPULATION_HEADER
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <fstream>
 #include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VNPGE_HAS_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define VNPGE_HAS_MMAP 0
+#endif
 
 
 /**
  * @brief Load a file into a string
- * 
+ *
  * @param path Path to file
  * @return Contents of file in a std::string
  */
-std::string loadFileToString(std::string path) {
+inline std::string loadFileToString(std::string path) {
 	// Open the file for reading
 	std::ifstream file;
 	std::stringstream string;
@@ -20,4 +33,96 @@ std::string loadFileToString(std::string path) {
 	string << file.rdbuf();
 	return string.str();
 }
-#endif
\ No newline at end of file
+
+
+/**
+ * @brief Read-only view of an entire file.
+ * Memory-maps the file where the platform allows it, and otherwise falls back to reading it into a single buffer.
+ * Either way, the contents stay at a fixed address for the lifetime of the object.
+ */
+class MappedFile {
+	private:
+	const char* bytes = nullptr;
+	std::size_t length = 0;
+
+	#if VNPGE_HAS_MMAP
+	void* mapping = nullptr;
+	#else
+	std::vector<char> buffer;
+	#endif
+
+	public:
+	MappedFile(const std::string& path) {
+		#if VNPGE_HAS_MMAP
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw std::runtime_error("Could not open file for mapping: " + path);
+		}
+
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			throw std::runtime_error("Could not stat file for mapping: " + path);
+		}
+		length = static_cast<std::size_t>(info.st_size);
+
+		// mmap refuses zero-length mappings, but an empty file is still a valid (empty) view
+		if (length > 0) {
+			mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping == MAP_FAILED) {
+				mapping = nullptr;
+				close(fd);
+				throw std::runtime_error("Could not map file: " + path);
+			}
+			bytes = static_cast<const char*>(mapping);
+		}
+		close(fd);
+		#else
+		std::ifstream file{path, std::ios::in | std::ios::binary | std::ios::ate};
+		if (!file) {
+			throw std::runtime_error("Could not open file for reading: " + path);
+		}
+		buffer.resize(static_cast<std::size_t>(file.tellg()));
+		file.seekg(0);
+		file.read(buffer.data(), buffer.size());
+
+		bytes = buffer.data();
+		length = buffer.size();
+		#endif
+	}
+
+	MappedFile(MappedFile&& f) noexcept : bytes{f.bytes}, length{f.length},
+	#if VNPGE_HAS_MMAP
+		mapping{f.mapping} {
+		f.mapping = nullptr;
+	#else
+		buffer{std::move(f.buffer)} {
+	#endif
+		f.bytes = nullptr;
+		f.length = 0;
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	~MappedFile() {
+		#if VNPGE_HAS_MMAP
+		if (mapping != nullptr) {
+			munmap(mapping, length);
+		}
+		#endif
+	}
+
+	const char* data() const {
+		return bytes;
+	}
+
+	std::size_t size() const {
+		return length;
+	}
+
+	std::string_view view() const {
+		return {bytes, length};
+	}
+};
+#endif
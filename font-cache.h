@@ -0,0 +1,157 @@
+#ifndef VNPGE_FONT_CACHE_HEADER
+#define VNPGE_FONT_CACHE_HEADER
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "structures.h"
+#include "files.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief Point size for dialogue in a text box.
+ * Splits a quarter of the box's height into the fewest lines that leave each one under 25 pixels tall,
+ * while keeping every line between 10 and 30 pixels, and derives the size from that line height.
+ */
+inline uint dialoguePtSize(const AbsoluteDimensions& boxDims) {
+	double boxHeight = static_cast<double>(boxDims.h) * 0.25;
+	uint numLines = 5;
+
+	// TODO: Evaluate pixel values based on DPI
+
+	if (boxHeight > 20) {
+		// At least 5 lines, as long as that doesn't take them below 10 pixels
+		double fewest = std::max(std::floor(boxHeight / 25), std::floor(boxHeight / 31) + 1);
+		numLines = static_cast<uint>(std::max(fewest, 5.0));
+		if (boxHeight / numLines < 10) {
+			numLines = static_cast<uint>(boxHeight / 10);
+		}
+	}
+	numLines += boxDims.h / boxDims.w;
+
+	return static_cast<uint>(std::round(boxHeight / static_cast<double>(numLines))) * 3;
+}
+
+
+/**
+ * @brief Map a font file into memory, or share the mapping if the file is already mapped.
+ * Fonts opened from the mapping have to hold on to it for as long as they're open; it's unmapped once none do.
+ */
+inline std::shared_ptr<const MappedFile> mapFontFile(const std::string& path) {
+	static std::mutex mutex;
+	static std::unordered_map<std::string, std::weak_ptr<const MappedFile>> files;
+
+	std::lock_guard lock{mutex};
+	std::weak_ptr<const MappedFile>& entry = files[path];
+	if (auto file = entry.lock()) {
+		return file;
+	}
+	auto file = std::make_shared<const MappedFile>(path);
+	entry = file;
+	return file;
+}
+
+
+/**
+ * @brief Everything that goes into opening a font. Backends whose fonts cover every size leave the size and DPI at 0.
+ */
+struct FontKey {
+	public:
+	std::string path;
+	uint ptSize = 0;
+	float hdpi = 0;
+	float vdpi = 0;
+
+	bool operator==(const FontKey&) const = default;
+};
+
+struct FontKeyHash {
+	public:
+	std::size_t operator()(const FontKey& key) const {
+		std::size_t h = std::hash<std::string>{}(key.path);
+		for (std::size_t part : {std::hash<uint>{}(key.ptSize), std::hash<float>{}(key.hdpi), std::hash<float>{}(key.vdpi)}) {
+			h ^= part + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+		}
+		return h;
+	}
+};
+
+
+/**
+ * @brief Opened fonts, keyed by path, point size and DPI; one process-wide cache per backend font type, from global().
+ * Fonts are handed out as shared handles, so copying one is a reference count, and a font stays open while anything holds it,
+ * even after the cache has let go of it. Sizes that have been used are kept, so resizing back and forth doesn't open anything again;
+ * only the least recently used fonts are dropped once there are more than capacity of them.
+ * Every size of a font reads from the same mapping of its file, from mapFontFile().
+ *
+ * @tparam Font Backend font type.
+ */
+template<typename Font>
+class FontCache {
+	public:
+	using Handle = std::shared_ptr<Font>;
+	// Opens a font from its mapped file; the font has to keep the mapping alive, say from its deleter
+	using Opener = std::function<Handle(const std::shared_ptr<const MappedFile>&)>;
+
+	private:
+	std::mutex mutex;
+
+	// Most recently used at the front
+	std::list<std::pair<FontKey, Handle>> fonts;
+	std::unordered_map<FontKey, typename std::list<std::pair<FontKey, Handle>>::iterator, FontKeyHash> index;
+	std::size_t capacity;
+
+	public:
+	FontCache(std::size_t capacity = 8) : capacity{capacity} {};
+
+	FontCache(const FontCache&) = delete;
+
+	static FontCache& global() {
+		static FontCache cache;
+		return cache;
+	}
+
+	/**
+	 * @brief Get a font, calling open to open it if it isn't in the cache.
+	 */
+	Handle get(const FontKey& key, const Opener& open) {
+		std::lock_guard lock{mutex};
+		if (auto it = index.find(key); it != index.end()) {
+			fonts.splice(fonts.begin(), fonts, it->second);
+			return it->second->second;
+		}
+
+		fonts.emplace_front(key, open(mapFontFile(key.path)));
+		index.emplace(key, fonts.begin());
+
+		if (fonts.size() > capacity) {
+			index.erase(fonts.back().first);
+			fonts.pop_back();
+		}
+		return fonts.front().second;
+	}
+
+	std::size_t size() {
+		std::lock_guard lock{mutex};
+		return fonts.size();
+	}
+
+	void clear() {
+		std::lock_guard lock{mutex};
+		index.clear();
+		fonts.clear();
+	}
+};
+
+}
+#endif
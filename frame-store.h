@@ -0,0 +1,202 @@
+#ifndef VNPGE_FRAME_STORE_HEADER
+#define VNPGE_FRAME_STORE_HEADER
+
+#include <compare>
+#include <cstddef>
+#include <iterator>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "structures.h"
+#include "intern.h"
+#include "text-arena.h"
+
+
+namespace vnpge {
+
+// Handles into a Chapter's interned tables; see Chapter
+using CharacterID = InternID;
+using ImageID = InternID;
+
+/**
+ * @brief A representation of an instant or moment in the story.
+ * Everything but the dialogue is a handle into the owning Chapter, resolved once at load time.
+ * Frames aren't stored as such; this is a lightweight view assembled from a FrameStore's columns.
+ */
+struct Frame {
+	public:
+	std::string_view textDialogue;
+	CharacterID character;
+	// Image of the character's expression in this frame
+	ImageID expression;
+	ImageID background;
+	PositionMapping position;
+};
+
+
+/**
+ * @brief Struct-of-arrays storage for a chapter's frames.
+ * Each field of Frame lives in its own contiguous column, so scanning one field across the whole chapter
+ * (finding every frame with a given background, say) only touches that field's memory.
+ * All dialogue shares one TextArena, with frames holding spans into it.
+ * Frames are append-only. Iterators are index-based and survive appends, but the dialogue views in a Frame
+ * only last until an append outgrows the space set aside by reserve().
+ */
+class FrameStore {
+	private:
+	TextArena dialogueArena;
+	std::vector<TextSpan> dialogueColumn;
+	std::vector<CharacterID> characterColumn;
+	std::vector<ImageID> expressionColumn;
+	std::vector<ImageID> backgroundColumn;
+	std::vector<PositionMapping> positionColumn;
+
+	public:
+	/**
+	 * @brief Random access iterator over the frames of a FrameStore.
+	 * Dereferencing assembles a Frame from the columns, so it yields a value rather than a reference.
+	 */
+	class iterator {
+		private:
+		const FrameStore* store = nullptr;
+		std::ptrdiff_t index = 0;
+
+		// Lets it->field work even though there's no Frame object to point at
+		struct ArrowProxy {
+			public:
+			Frame frame;
+			const Frame* operator->() const {
+				return &frame;
+			}
+		};
+
+		public:
+		// Like std::vector<bool>'s iterator, this claims random access despite yielding values,
+		// so that std::next, std::prev and friends take the fast (and, for prev, working) path
+		using iterator_concept = std::random_access_iterator_tag;
+		using iterator_category = std::random_access_iterator_tag;
+		using value_type = Frame;
+		using difference_type = std::ptrdiff_t;
+		using reference = Frame;
+		using pointer = ArrowProxy;
+
+		iterator() = default;
+		iterator(const FrameStore* store, std::ptrdiff_t index) : store{store}, index{index} {};
+
+		Frame operator*() const {
+			return (*store)[index];
+		}
+
+		ArrowProxy operator->() const {
+			return {**this};
+		}
+
+		Frame operator[](difference_type n) const {
+			return (*store)[index + n];
+		}
+
+		// Position of the frame within the chapter
+		std::size_t getIndex() const {
+			return static_cast<std::size_t>(index);
+		}
+
+		iterator& operator++() { ++index; return *this; }
+		iterator& operator--() { --index; return *this; }
+		iterator operator++(int) { auto old = *this; ++index; return old; }
+		iterator operator--(int) { auto old = *this; --index; return old; }
+
+		iterator& operator+=(difference_type n) { index += n; return *this; }
+		iterator& operator-=(difference_type n) { index -= n; return *this; }
+
+		friend iterator operator+(iterator it, difference_type n) { return it += n; }
+		friend iterator operator+(difference_type n, iterator it) { return it += n; }
+		friend iterator operator-(iterator it, difference_type n) { return it -= n; }
+		friend difference_type operator-(const iterator& a, const iterator& b) { return a.index - b.index; }
+
+		friend bool operator==(const iterator& a, const iterator& b) { return a.index == b.index; }
+		friend auto operator<=>(const iterator& a, const iterator& b) { return a.index <=> b.index; }
+	};
+
+	FrameStore() = default;
+
+	/**
+	 * @brief Set aside room for frames and their dialogue.
+	 * 
+	 * @param n Number of frames.
+	 * @param dialogueBytes Combined size of all of their dialogue.
+	 */
+	void reserve(std::size_t n, std::size_t dialogueBytes) {
+		dialogueArena.reserve(dialogueBytes);
+		dialogueColumn.reserve(n);
+		characterColumn.reserve(n);
+		expressionColumn.reserve(n);
+		backgroundColumn.reserve(n);
+		positionColumn.reserve(n);
+	}
+
+	void push_back(std::string_view textDialogue, CharacterID character, ImageID expression, ImageID background, const PositionMapping& position) {
+		dialogueColumn.push_back(dialogueArena.append(textDialogue));
+		characterColumn.push_back(character);
+		expressionColumn.push_back(expression);
+		backgroundColumn.push_back(background);
+		positionColumn.push_back(position);
+	}
+
+	Frame operator[](std::size_t i) const {
+		return {
+			.textDialogue = dialogueArena.view(dialogueColumn[i]),
+			.character = characterColumn[i],
+			.expression = expressionColumn[i],
+			.background = backgroundColumn[i],
+			.position = positionColumn[i]
+		};
+	}
+
+	std::size_t size() const {
+		return characterColumn.size();
+	}
+
+	bool empty() const {
+		return characterColumn.empty();
+	}
+
+	iterator begin() const {
+		return {this, 0};
+	}
+
+	iterator end() const {
+		return {this, static_cast<std::ptrdiff_t>(size())};
+	}
+
+	// Whole columns, for scans over a single field
+	std::span<const TextSpan> dialogue() const {
+		return dialogueColumn;
+	}
+
+	const TextArena& dialogueText() const {
+		return dialogueArena;
+	}
+
+	std::span<const CharacterID> characters() const {
+		return characterColumn;
+	}
+
+	std::span<const ImageID> expressions() const {
+		return expressionColumn;
+	}
+
+	std::span<const ImageID> backgrounds() const {
+		return backgroundColumn;
+	}
+
+	std::span<const PositionMapping> positions() const {
+		return positionColumn;
+	}
+};
+
+static_assert(std::random_access_iterator<FrameStore::iterator>);
+
+}
+#endif
@@ -1,11 +1,8 @@
-
 #include <string>
 
+#include "image.h"
+
 
 namespace vnpge {
-class Image {
-	public:
-	std::string path;
-	Image(std::string path) : path{path} {};
-};
-}
\ No newline at end of file
+	Image::Image(std::string path) : path{path} {};
+}
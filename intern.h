@@ -0,0 +1,83 @@
+#ifndef VNPGE_INTERN_HEADER
+#define VNPGE_INTERN_HEADER
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <stdexcept>
+
+
+namespace vnpge {
+
+// Dense handle for an interned string; handles count up from 0 in order of first appearance
+using InternID = std::uint32_t;
+
+/**
+ * @brief Two-way mapping between strings and dense integer handles.
+ * Lets anything that would otherwise be keyed by ID or path (characters, expressions, images) be stored in plain vectors indexed by handle.
+ * Strings are stored once, at stable addresses, so handles and the views handed out stay valid for the lifetime of the table.
+ */
+class InternTable {
+	private:
+	// A deque never moves its elements on push_back, so the views used as map keys can't dangle
+	std::deque<std::string> strings;
+	std::unordered_map<std::string_view, InternID> ids;
+
+	public:
+	InternTable() = default;
+
+	// The map's keys point into this table's own strings, so a copy would point back into the original
+	InternTable(const InternTable&) = delete;
+	InternTable& operator=(const InternTable&) = delete;
+
+	InternTable(InternTable&&) = default;
+	InternTable& operator=(InternTable&&) = default;
+
+	/**
+	 * @brief Get the handle for a string, adding it to the table if it isn't already there.
+	 */
+	InternID intern(std::string_view s) {
+		if (auto it = ids.find(s); it != ids.end()) {
+			return it->second;
+		}
+		auto id = static_cast<InternID>(strings.size());
+		const std::string& stored = strings.emplace_back(s);
+		ids.emplace(stored, id);
+		return id;
+	}
+
+	/**
+	 * @brief Get the handle for a string, if it has been interned.
+	 */
+	std::optional<InternID> find(std::string_view s) const {
+		if (auto it = ids.find(s); it != ids.end()) {
+			return it->second;
+		}
+		return std::nullopt;
+	}
+
+	/**
+	 * @brief Get the handle for a string that must already have been interned.
+	 * Throws if it hasn't, much like std::unordered_map::at.
+	 */
+	InternID at(std::string_view s) const {
+		if (auto it = ids.find(s); it != ids.end()) {
+			return it->second;
+		}
+		throw std::out_of_range("'" + std::string{s} + "' was never interned");
+	}
+
+	const std::string& operator[](InternID id) const {
+		return strings[id];
+	}
+
+	std::size_t size() const {
+		return strings.size();
+	}
+};
+
+}
+#endif
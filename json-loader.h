@@ -17,8 +17,8 @@ namespace vnpge {
 
 namespace json = boost::json;
 
-class JSONLoader : ChapterLoader {
-	private:
+class JSONLoader : public ChapterLoader {
+	protected:
 	static std::vector<std::string> loadIndex(std::string indexPath) {
 		// TODO: have this function return the chapter file paths, sorted by file type
 
@@ -47,17 +47,19 @@ class JSONLoader : ChapterLoader {
 
 	
 
-	Chapter loadChapter() {
-		
-		// TODO: make this loop through all paths instead of just picking the first one
-		// This is simple to do, but would probably require nesting all of this function inside of a loop
-
+	/**
+	 * @brief Parse a single JSON chapter script into its meta representation.
+	 * 
+	 * @param path Path to the chapter script.
+	 * @return The chapter's name, MetaCharacters and MetaFrames, not yet bound into a Chapter.
+	 */
+	static MetaChapter parseChapter(const std::string& path) {
 		// TODO: Gracefully handle the exception that occurs when invalid JSON is passed in
 		// Also, we could allow JSON extensions here, but for now strict compliance is the best option
 		json::object rootObj;
 		{
 		json::value root;
-		root = json::parse(loadFileToString(paths[0]));
+		root = json::parse(loadFileToString(path));
 		rootObj = root.as_object();
 		}
 
@@ -124,9 +126,16 @@ class JSONLoader : ChapterLoader {
 				};
 			}
 			// This throws if any character IDs in the source JSON were misspelled
-			metaFrames.emplace_back(textDialogue, charIDToMetaRefMap.at(characterID), expression, posMap, background);
+			metaFrames.emplace_back(std::move(textDialogue), charIDToMetaRefMap.at(characterID), std::move(expression), posMap, std::move(background));
 		}
-		return {chapterName, metaCharacters, metaFrames};
+		return {std::move(chapterName), std::move(metaCharacters), std::move(metaFrames)};
+	}
+
+	using ChapterLoader::loadChapter;
+
+	Chapter loadChapter(const std::string& path) override {
+		MetaChapter meta = parseChapter(path);
+		return {std::move(meta.chapterName), meta.metaCharacters, meta.metaFrames};
 	}
 };
 }
@@ -0,0 +1,359 @@
+#ifndef VNPGE_JSON_STREAM_LOADER_HEADER
+#define VNPGE_JSON_STREAM_LOADER_HEADER
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+#include <boost/json/basic_parser_impl.hpp>
+
+#include "structures.h"
+#include "loader.h"
+#include "json-loader.h"
+
+#include "character.h"
+#include "chapter.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief SAX handler for boost::json::basic_parser that builds a Chapter straight from the token stream.
+ * Characters are kept as MetaCharacters until they've all been seen, as frames refer to them.
+ * After that, each frame goes into the Chapter's FrameStore as soon as its object ends, so only one is ever held on its own; no DOM is built.
+ * Frames that come before the characters in the script can't be resolved yet, so those are held as MetaFrames until the end.
+ *
+ * Values are recognised by where they sit in the document, by container depth:
+ *   1: root object                 ("chapterName", "storyCharacters", "storyFrames", ...)
+ *   2: storyCharacters/storyFrames arrays
+ *   3: a single character or frame object
+ *   4: a character's "expressions" object, or a frame's "position" array
+ *   5: a frame's [x, y] position pairs
+ * Anything else (e.g. "backgrounds") is skipped over.
+ */
+class ChapterStreamHandler {
+	private:
+	enum struct Section {
+		other,
+		characters,
+		frames
+	};
+
+	std::string chapterName;
+	std::vector<MetaCharacter> metaCharacters;
+	bool charactersDone = false;
+
+	// Built when the frames start, if every character is known by then
+	std::optional<Chapter> chapter;
+	// Frames seen before the characters were
+	std::vector<MetaFrame> pendingFrames;
+
+	// Nesting depth of the container currently being parsed, and the most recent key seen at each depth
+	uint depth = 0;
+	std::array<std::string, 6> keys;
+
+	// Accumulates keys and strings that arrive in multiple parts
+	std::string buffer;
+
+	Section section = Section::other;
+
+	// Fields of the character currently being parsed
+	std::string charID;
+	std::string charName;
+	std::unordered_map<std::string, std::string> metaExpressions;
+
+	// Fields of the frame currently being parsed
+	std::string textDialogue;
+	std::string characterID;
+	std::string expression;
+	std::string background;
+	std::array<double, 4> position;
+	// Number of [x, y] pairs finished so far, and of coordinates in the pair currently being parsed
+	uint positionPairs = 0;
+	uint pairCoords = 0;
+
+	bool fail(std::string message, boost::json::error_code& ec) {
+		errorMessage = std::move(message);
+		ec = boost::json::error::syntax;
+		return false;
+	}
+
+	bool inPosition() const {
+		return section == Section::frames && keys[3] == "position";
+	}
+
+	bool onNumber(double d, boost::json::error_code& ec) {
+		if (depth == 4 && inPosition()) {
+			return fail("A story frame's position must hold [x, y] pairs, not bare numbers", ec);
+		}
+		if (depth == 5 && inPosition()) {
+			if (pairCoords >= 2) {
+				return fail("A story frame's position pair has more than two coordinates", ec);
+			}
+			position[positionPairs * 2 + pairCoords++] = d;
+		}
+		return true;
+	}
+
+	public:
+	constexpr static std::size_t max_object_size = std::size_t(-1);
+	constexpr static std::size_t max_array_size = std::size_t(-1);
+	constexpr static std::size_t max_key_size = std::size_t(-1);
+	constexpr static std::size_t max_string_size = std::size_t(-1);
+
+	// Set whenever the handler itself rejects the document, since the parser only reports a generic error code
+	std::string errorMessage;
+
+	ChapterStreamHandler() = default;
+
+	/**
+	 * @brief The finished chapter, once the whole document has been parsed. Can only be taken once.
+	 * Throws std::runtime_error if frames that came before the characters refer to ones that don't exist.
+	 */
+	Chapter finish() {
+		if (!chapter) {
+			chapter.emplace(std::move(chapterName), metaCharacters, pendingFrames);
+		}
+		else {
+			chapter->chapterName = std::move(chapterName);
+		}
+		return std::move(*chapter);
+	}
+
+	bool on_document_begin(boost::json::error_code& ec) { return true; }
+	bool on_document_end(boost::json::error_code& ec) { return true; }
+
+	bool on_object_begin(boost::json::error_code& ec) {
+		if (++depth >= keys.size()) {
+			return fail("Chapter script is nested deeper than the chapter format allows", ec);
+		}
+		keys[depth].clear();
+
+		if (depth == 3) {
+			// A new character or frame starts; forget the previous one
+			charID.clear();
+			charName.clear();
+			metaExpressions.clear();
+
+			textDialogue.clear();
+			characterID.clear();
+			expression.clear();
+			background.clear();
+			positionPairs = 0;
+			pairCoords = 0;
+		}
+		return true;
+	}
+
+	bool on_object_end(std::size_t n, boost::json::error_code& ec) {
+		if (depth == 3 && section == Section::characters) {
+			metaCharacters.emplace_back(std::move(charName), metaExpressions, std::move(charID));
+		}
+		else if (depth == 3 && section == Section::frames) {
+			if (positionPairs != 2) {
+				return fail("Story frame '" + textDialogue + "' needs a position of the form [[srcX, srcY], [destX, destY]]", ec);
+			}
+			PositionMapping posMap = {
+				.srcPos = {
+					.x = position[0],
+					.y = position[1]
+				},
+				.destPos = {
+					.x = position[2],
+					.y = position[3]
+				}
+			};
+			if (!chapter) {
+				pendingFrames.emplace_back(std::move(textDialogue), std::move(characterID), std::move(expression), posMap, std::move(background));
+			}
+			else {
+				try {
+					chapter->addFrame(textDialogue, characterID, expression, background, posMap);
+				}
+				catch (const std::exception& e) {
+					return fail(e.what(), ec);
+				}
+			}
+		}
+		depth--;
+		return true;
+	}
+
+	bool on_array_begin(boost::json::error_code& ec) {
+		if (++depth >= keys.size()) {
+			return fail("Chapter script is nested deeper than the chapter format allows", ec);
+		}
+		keys[depth].clear();
+
+		if (depth == 2) {
+			if (keys[1] == "storyCharacters") {
+				section = Section::characters;
+			}
+			else if (keys[1] == "storyFrames") {
+				section = Section::frames;
+				if (charactersDone && !chapter) {
+					// The name may still be to come; it's filled in by finish()
+					try {
+						chapter.emplace(std::string{}, metaCharacters);
+					}
+					catch (const std::exception& e) {
+						return fail(e.what(), ec);
+					}
+					metaCharacters.clear();
+				}
+			}
+			else {
+				section = Section::other;
+			}
+		}
+		else if (depth == 5 && inPosition()) {
+			if (positionPairs >= 2) {
+				return fail("A story frame's position has more than two [x, y] pairs", ec);
+			}
+			pairCoords = 0;
+		}
+		return true;
+	}
+
+	bool on_array_end(std::size_t n, boost::json::error_code& ec) {
+		if (depth == 2) {
+			if (section == Section::characters) {
+				charactersDone = true;
+			}
+			section = Section::other;
+		}
+		else if (depth == 5 && inPosition()) {
+			if (pairCoords != 2) {
+				return fail("A story frame's position pair needs exactly two coordinates", ec);
+			}
+			positionPairs++;
+		}
+		depth--;
+		return true;
+	}
+
+	bool on_key_part(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+		buffer.append(s.data(), s.size());
+		return true;
+	}
+
+	bool on_key(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+		buffer.append(s.data(), s.size());
+		keys[depth].swap(buffer);
+		buffer.clear();
+		return true;
+	}
+
+	bool on_string_part(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+		buffer.append(s.data(), s.size());
+		return true;
+	}
+
+	bool on_string(boost::json::string_view s, std::size_t n, boost::json::error_code& ec) {
+		buffer.append(s.data(), s.size());
+
+		if (depth == 1 && keys[1] == "chapterName") {
+			chapterName = buffer;
+		}
+		else if (section == Section::characters && depth == 3) {
+			if (keys[3] == "id") {
+				charID = buffer;
+			}
+			else if (keys[3] == "name") {
+				charName = buffer;
+			}
+		}
+		else if (section == Section::characters && depth == 4 && keys[3] == "expressions") {
+			metaExpressions.insert({keys[4], buffer});
+		}
+		else if (section == Section::frames && depth == 3) {
+			if (keys[3] == "textDialogue") {
+				textDialogue = buffer;
+			}
+			else if (keys[3] == "characterID") {
+				characterID = buffer;
+			}
+			else if (keys[3] == "expression") {
+				expression = buffer;
+			}
+			else if (keys[3] == "background") {
+				background = buffer;
+			}
+		}
+
+		buffer.clear();
+		return true;
+	}
+
+	bool on_number_part(boost::json::string_view s, boost::json::error_code& ec) { return true; }
+
+	bool on_int64(std::int64_t i, boost::json::string_view s, boost::json::error_code& ec) {
+		return onNumber(static_cast<double>(i), ec);
+	}
+
+	bool on_uint64(std::uint64_t u, boost::json::string_view s, boost::json::error_code& ec) {
+		return onNumber(static_cast<double>(u), ec);
+	}
+
+	bool on_double(double d, boost::json::string_view s, boost::json::error_code& ec) {
+		return onNumber(d, ec);
+	}
+
+	bool on_bool(bool b, boost::json::error_code& ec) { return true; }
+	bool on_null(boost::json::error_code& ec) { return true; }
+	bool on_comment_part(boost::json::string_view s, boost::json::error_code& ec) { return true; }
+	bool on_comment(boost::json::string_view s, boost::json::error_code& ec) { return true; }
+};
+
+
+/**
+ * @brief JSON chapter loader that streams the script through a SAX parser instead of building a DOM.
+ * Reads the file in fixed-size chunks, and frames go straight into the Chapter as they're parsed,
+ * so peak memory is the chapter being built plus one chunk, rather than the whole document twice over.
+ * That holds for scripts that define their characters before their frames; frames before the characters are buffered until the end.
+ */
+class JSONStreamLoader : public JSONLoader {
+	private:
+	static constexpr std::size_t chunkSize = 64 * 1024;
+
+	public:
+	JSONStreamLoader(std::string indexPath) : JSONLoader(indexPath) {};
+
+	using ChapterLoader::loadChapter;
+
+	Chapter loadChapter(const std::string& path) override {
+		std::ifstream file{path, std::ios::in | std::ios::binary};
+		if (!file) {
+			throw std::runtime_error("Could not open chapter script " + path);
+		}
+
+		boost::json::basic_parser<ChapterStreamHandler> parser{boost::json::parse_options{}};
+		boost::json::error_code ec;
+
+		auto check = [&]() {
+			if (ec) {
+				std::string reason = parser.handler().errorMessage.empty() ? ec.message() : parser.handler().errorMessage;
+				throw std::runtime_error("Could not parse chapter script " + path + ": " + reason);
+			}
+		};
+
+		std::vector<char> chunk(chunkSize);
+		while (file) {
+			file.read(chunk.data(), chunk.size());
+			parser.write_some(true, chunk.data(), static_cast<std::size_t>(file.gcount()), ec);
+			check();
+		}
+		// Tell the parser there's nothing more coming, so it can reject truncated documents
+		parser.write_some(false, nullptr, 0, ec);
+		check();
+
+		return parser.handler().finish();
+	}
+};
+}
+#endif
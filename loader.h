@@ -5,17 +5,112 @@
 #include <vector>
 #include <string>
 #include <stdexcept>
+#include <optional>
+#include <exception>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "chapter.h"
 
 
 namespace vnpge {
 
+/**
+ * @brief A loaded chapter, along with where it came from and how long it took to load.
+ */
+struct ChapterLoadResult {
+	public:
+	std::string path;
+	Chapter chapter;
+	std::chrono::microseconds loadTime;
+};
+
+// Loaded chapters, keyed by chapter name
+using ChapterCollection = std::unordered_map<std::string, ChapterLoadResult>;
+
 class ChapterLoader {
 	protected:
 	std::vector<std::string> paths;
-	
+
 	public:
 	ChapterLoader(std::vector<std::string> paths) : paths{paths} {}
 
+	virtual ~ChapterLoader() = default;
+
+	/**
+	 * @brief Load a single chapter.
+	 * Must be safe to call from several threads at once, as loadAllChapters does exactly that.
+	 *
+	 * @param path Path to the chapter file, in whatever format the loader reads.
+	 */
+	virtual Chapter loadChapter(const std::string& path) = 0;
+
+	/**
+	 * @brief Load the first chapter in the index.
+	 */
+	Chapter loadChapter() {
+		return loadChapter(paths[0]);
+	}
+
+	/**
+	 * @brief Load every chapter in the index concurrently.
+	 * Each worker thread pulls the next unloaded path until all are done, so a few large chapters don't hold up the rest.
+	 * If any chapter fails to load, the first failure is rethrown once all workers have finished.
+	 *
+	 * @param threadCount Number of worker threads; 0 means one per hardware thread.
+	 * @return All chapters, keyed by chapter name.
+	 */
+	ChapterCollection loadAllChapters(uint threadCount = 0) {
+		if (threadCount == 0) {
+			threadCount = std::max(1u, std::thread::hardware_concurrency());
+		}
+		threadCount = std::min(threadCount, static_cast<uint>(paths.size()));
+
+		std::vector<std::optional<ChapterLoadResult>> results(paths.size());
+		std::vector<std::exception_ptr> errors(paths.size());
+		std::atomic<std::size_t> nextPath = 0;
+
+		auto worker = [&]() {
+			for (std::size_t i = nextPath++; i < paths.size(); i = nextPath++) {
+				try {
+					auto start = std::chrono::steady_clock::now();
+					Chapter chapter = loadChapter(paths[i]);
+					auto loadTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+					results[i].emplace(paths[i], std::move(chapter), loadTime);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		{
+			std::vector<std::jthread> workers;
+			workers.reserve(threadCount);
+			for (uint t = 0; t < threadCount; t++) {
+				workers.emplace_back(worker);
+			}
+		}
+
+		for (auto& error : errors) {
+			if (error) {
+				std::rethrow_exception(error);
+			}
+		}
+
+		ChapterCollection chapters;
+		chapters.reserve(results.size());
+		for (auto& result : results) {
+			std::string name = result->chapter.chapterName;
+			if (!chapters.emplace(name, std::move(*result)).second) {
+				throw std::runtime_error("Chapter name '" + name + "' is used by more than one chapter in the index!");
+			}
+		}
+		return chapters;
+	}
 };
 
 }
@@ -27,7 +27,9 @@
 
 #include "image.h"
 #include "chapter.h"
-#include "json-loader.h"
+#include "json-stream-loader.h"
+#include "damage.h"
+#include "chapter-layout.h"
 
 #include "debug.h"
 
@@ -39,6 +41,7 @@
 #ifdef GPU_RENDER
 import AcceleratedText;
 import AcceleratedRender;
+import ImagePrefetch;
 #else 
 import SoftwareText;
 import SoftwareRender;
@@ -93,31 +96,85 @@ int main() {
 	TextBoxInfo boxInfo = { SDLInfo.getScreenDimensions(), {.w = 1.0, .h = 0.25} };
 	
 	#ifdef GPU_RENDER
-	TextRenderer textRenderer = { SDLInfo.getWindowRenderer().getRenderer(), boxInfo, textBGGenerator, {"placeholder", "this is a bug", {0, 0, 0}}, {"assets/fonts/BonaNova-Italic.ttf"}};
+	TextRenderer textRenderer = { SDLInfo.getWindowRenderer().getRenderer(), boxInfo, textBGGenerator, {"placeholder", "this is a bug", {0, 0, 0}}, {dialogueFontPath}};
 	#else
-	TextRenderer textRenderer = { SDLInfo.getScreenSurface(), boxInfo, textBGGenerator, {"placeholder", "this is a bug", {0, 0, 0}}, {"assets/fonts/BonaNova-Italic.ttf"}};
+	TextRenderer textRenderer = { SDLInfo.getScreenSurface(), boxInfo, textBGGenerator, {"placeholder", "this is a bug", {0, 0, 0}}, {dialogueFontPath}};
 	#endif
 
 
 
 	// Load chapter data
-	JSONLoader loader = {"assets/scripts/index.json"};
+	JSONStreamLoader loader = {"assets/scripts/index.json"};
 	
 	Chapter chapter = loader.loadChapter();
 
 
 	auto& curFrame = chapter.curFrame;
 
+	// Work out every frame's line breaks in the background, so turning the page only has to draw them.
+	// Until that's done, or while it's redone after a resize, each page is laid out as it's shown
+	ChapterLayoutJob layoutJob;
+	auto relayout = [&] {
+		chapter.dialogueLayout.reset();
+		layoutJob.start(chapter.storyFrames, textRenderer.makeLayoutMetrics({dialogueFontPath}),
+		                textRenderer.getLayoutFontKey({dialogueFontPath}), textRenderer.getWrapWidth());
+	};
+	relayout();
+
+	#ifdef GPU_RENDER
+	// Decode upcoming backgrounds and expressions in the background, so turning the page doesn't stall on file IO
+	constexpr uint prefetchLookahead = 4;
+	ImagePrefetcher prefetcher;
+	auto isLoaded = [&](const std::string& path) { return SDLInfo.getWindowRenderer().hasImage(path); };
+	prefetcher.prefetch(chapter, prefetchLookahead, isLoaded);
+	#endif
 	
-	renderFrame(SDLInfo, *curFrame, textRenderer);
-	
+	renderFrame(SDLInfo, chapter, textRenderer);
 	
+	// Milliseconds a page stays up before advancing by itself; 0 leaves it to the reader
+	constexpr uint autoAdvanceMs = 0;
+	// How often to wake up while the prefetcher or the layout job still have something to hand over
+	constexpr int backgroundPollMs = 20;
+
+	TimerQueue timers;
+	if (autoAdvanceMs) {
+		timers.schedule(Action::next_page, autoAdvanceMs);
+	}
+
+	LatencyStats latency;
+	// Reused every iteration, so waiting for input doesn't allocate
+	std::vector<Event> events;
+	events.reserve(32);
+
+	// Sleeps until there's input, a timer is due or there's something to upload, rather than polling on a fixed delay
 	while (true)   {
-		auto events = handleEvents();
+		int timeout = timers.timeUntilNext();
+		#ifdef GPU_RENDER
+		SDLInfo.getWindowRenderer().uploadPrefetched(prefetcher);
+		if (prefetcher.busy() && (timeout < 0 || timeout > backgroundPollMs)) {
+			timeout = backgroundPollMs;
+		}
+		#endif
+
+		// The layout lines up with what's already on screen, so installing it needs no redraw
+		if (auto layout = layoutJob.take()) {
+			chapter.dialogueLayout = std::move(layout);
+		}
+		if (layoutJob.busy() && (timeout < 0 || timeout > backgroundPollMs)) {
+			timeout = backgroundPollMs;
+		}
+
+		waitEvents(events, timeout);
+		timers.fire(events);
+
+		// Everything the events below change, so the screen is redrawn once for the lot, and only where needed
+		Damage damage;
+		auto shownFrame = curFrame;
 		for (auto& ev : events) {
 			switch (ev.getAction()) {
 				
 				case Action::clean_exit: {
+					cout << "input to present latency: " << latency.count() << " frames, mean " << latency.mean() << " ms, worst " << latency.max() << " ms" << endl;
 					return 0;
 				}
 				break;
@@ -125,22 +182,26 @@ int main() {
 				case Action::next_page: {
 					chapter.nextFrame();
 					textRenderer.resetScroll();
+					damage.mark(Layer::textScroll);
 				}
 				break;
 
 				case Action::prev_page: {
 					chapter.prevFrame();
 					textRenderer.resetScroll();
+					damage.mark(Layer::textScroll);
 				}
 				break;
 
 				case Action::scroll_up: {
 					textRenderer.scrollTextUp();
+					damage.mark(Layer::textScroll);
 				}
 				break;
 
 				case Action::scroll_down: {
 					textRenderer.scrollTextDown();
+					damage.mark(Layer::textScroll);
 				}
 				break;
 
@@ -150,10 +211,14 @@ int main() {
 					AbsoluteDimensions screenDims = {static_cast<uint>(ev.getData().first), static_cast<uint>(ev.getData().second) };
 					TextBoxInfo info = { screenDims, {.w = 1.0, .h = 0.25} };
 					#ifdef GPU_RENDER
+					SDLInfo.getWindowRenderer().invalidateOutputSize();
 					textRenderer.updateResolution(SDLInfo.getWindowRenderer().getRenderer(), info, textBGGenerator);
 					#else
 					textRenderer.updateResolution(SDLInfo.getScreenSurface(), info, textBGGenerator);
 					#endif
+					// Lines break differently at the new size
+					relayout();
+					damage.mark(Damage::all());
 				}
 				break;
 				case Action::nothing: {
@@ -167,15 +232,27 @@ int main() {
 			if (curFrame == chapter.storyFrames.end()) {
 				return 0;
 			}
-			
-			
-			// Only render the frame if there is anything to do.
-			// All current events cause a screen change, so reaching this point means it has to be run.
-			
-			renderFrame(SDLInfo, *curFrame, textRenderer);
 		}
-		
-		SDL_Delay(10);
+
+		if (curFrame != shownFrame) {
+			damage.mark(Damage::betweenFrames(*shownFrame, *curFrame));
+			#ifdef GPU_RENDER
+			prefetcher.prefetch(chapter, prefetchLookahead, isLoaded);
+			#endif
+
+			// Each page gets the full delay, however it was reached
+			if (autoAdvanceMs) {
+				timers.cancel(Action::next_page);
+				timers.schedule(Action::next_page, autoAdvanceMs);
+			}
+		}
+
+		// Idle wakeups and no-op input skip rendering entirely
+		if (damage.any()) {
+			renderFrame(SDLInfo, chapter, textRenderer, damage);
+			// Measured from the oldest input in the batch, since that one waited longest
+			latency.record(events.front().getTimestamp());
+		}
 	}
 
 	// TODO:
@@ -1,6 +1,12 @@
 #ifndef SCHEDULER_HEADER
 #define SCHEDULER_HEADER
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
 #include <stdexcept>
 #include <string>
 #include <vector>
@@ -28,9 +34,12 @@ class Event {
 
 	int data1;
 	int data2;
+
+	// When the input behind the event happened, in milliseconds on the SDL_GetTicks() clock; 0 if unknown
+	std::uint32_t timestamp;
 	public:
 
-	Event(Action action, int data1 = 255, int data2 = 255) : action{action}, data1{data1}, data2{data2} {};
+	Event(Action action, int data1 = 255, int data2 = 255, std::uint32_t timestamp = 0) : action{action}, data1{data1}, data2{data2}, timestamp{timestamp} {};
 
 	Action getAction() {
 		return action;
@@ -39,6 +48,10 @@ class Event {
 	std::pair<int, int> getData() {
 		return {data1, data2};
 	}
+
+	std::uint32_t getTimestamp() const {
+		return timestamp;
+	}
 };
 
 /**
@@ -110,5 +123,258 @@ class Schedule {
 		return elements.end();
 	}
 };
+namespace detail {
+	// Uninitialised room for one element of a ring schedule; elements are constructed in place on enqueue and destroyed on next()
+	template <typename T>
+	struct RingSlot {
+		public:
+		alignas(T) std::byte storage[sizeof(T)];
+
+		T* get() {
+			return std::launder(reinterpret_cast<T*>(storage));
+		}
+	};
+
+	// Keeps the producer's and consumer's counters on separate cache lines, so they don't slow each other down
+	inline constexpr std::size_t cacheLine = 64;
+}
+
+/**
+ * @brief Bounded single-producer, single-consumer Schedule for handing things from one thread to another.
+ * Lock-free, and allocation-free once constructed. One thread may enqueue() while another consumes through
+ * get()/next()/isValid(), which work like they do on Schedule, except that next() consumes the element.
+ * 
+ * @tparam T Element type.
+ * @tparam Capacity Maximum number of elements queued at once; must be a power of two.
+ */
+template <typename T, std::size_t Capacity>
+class SPSCSchedule {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "SPSCSchedule capacity must be a power of two");
+
+	private:
+	static constexpr std::size_t mask = Capacity - 1;
+
+	std::array<detail::RingSlot<T>, Capacity> slots;
+
+	// Counters only ever go up; masking them gives the slot
+	// Next element to consume; written by the consumer
+	alignas(detail::cacheLine) std::atomic<std::size_t> head = 0;
+	// Next slot to fill; written by the producer
+	alignas(detail::cacheLine) std::atomic<std::size_t> tail = 0;
+
+	template <typename U>
+	bool push(U&& element) {
+		std::size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity) {
+			return false;
+		}
+		std::construct_at(slots[t & mask].get(), std::forward<U>(element));
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	public:
+	SPSCSchedule() = default;
+
+	// Elements live inside the schedule itself, and the threads sharing it hold on to its address
+	SPSCSchedule(const SPSCSchedule&) = delete;
+	SPSCSchedule& operator=(const SPSCSchedule&) = delete;
+
+	~SPSCSchedule() {
+		while (isValid()) {
+			next();
+		}
+	}
+
+	/**
+	 * @brief Queue an element. Producer only.
+	 * 
+	 * @return Whether there was room. If not, element is left untouched, so it can be retried.
+	 */
+	bool enqueue(const T& element) {
+		return push(element);
+	}
+
+	bool enqueue(T&& element) {
+		return push(std::move(element));
+	}
+
+	/**
+	 * @brief The oldest element. Consumer only, and only while isValid().
+	 */
+	T& get() {
+		return *slots[head.load(std::memory_order_relaxed) & mask].get();
+	}
+
+	/**
+	 * @brief Consume the oldest element. Consumer only.
+	 * 
+	 * @return false if there was nothing to consume.
+	 */
+	bool next() {
+		std::size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) {
+			std::cout << "An attempt was made to step past the end of the SPSCSchedule!" << std::endl;
+			return false;
+		}
+		std::destroy_at(slots[h & mask].get());
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * @brief Whether there's an element to get(). Consumer only.
+	 */
+	bool isValid() {
+		return head.load(std::memory_order_relaxed) != tail.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * @brief Number of queued elements. Only a snapshot when called while the other thread is active.
+	 */
+	int length() {
+		return static_cast<int>(tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire));
+	}
+
+	static constexpr std::size_t capacity() {
+		return Capacity;
+	}
+};
+
+/**
+ * @brief Bounded multi-producer, single-consumer Schedule, for several threads posting to one.
+ * Lock-free, and allocation-free once constructed. Any number of threads may enqueue(), while one thread consumes
+ * through get()/next()/isValid() as with SPSCSchedule.
+ * Each slot carries a sequence number saying whose turn it is, so producers only contend on claiming a slot, never on filling it.
+ * 
+ * @tparam T Element type.
+ * @tparam Capacity Maximum number of elements queued at once; must be a power of two.
+ */
+template <typename T, std::size_t Capacity>
+class MPSCSchedule {
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "MPSCSchedule capacity must be a power of two");
+
+	private:
+	static constexpr std::size_t mask = Capacity - 1;
+
+	struct Slot {
+		public:
+		// Equal to the position it will be filled at while empty, and one past that once filled
+		std::atomic<std::size_t> sequence;
+		detail::RingSlot<T> element;
+	};
+
+	std::array<Slot, Capacity> slots;
+
+	// Next element to consume; only touched by the consumer
+	alignas(detail::cacheLine) std::atomic<std::size_t> head = 0;
+	// Next slot to claim; shared between the producers
+	alignas(detail::cacheLine) std::atomic<std::size_t> tail = 0;
+
+	template <typename U>
+	bool push(U&& element) {
+		std::size_t pos = tail.load(std::memory_order_relaxed);
+		Slot* slot;
+		while (true) {
+			slot = &slots[pos & mask];
+			std::size_t seq = slot->sequence.load(std::memory_order_acquire);
+			auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+			if (diff == 0) {
+				// The slot is free; try to claim it. On failure, pos is updated to the current tail
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				// The consumer hasn't got to this slot since it was last filled, so the ring is full
+				return false;
+			}
+			else {
+				// Another producer claimed it first
+				pos = tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		std::construct_at(slot->element.get(), std::forward<U>(element));
+		slot->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	public:
+	MPSCSchedule() {
+		for (std::size_t i = 0; i < Capacity; i++) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Elements live inside the schedule itself, and the threads sharing it hold on to its address
+	MPSCSchedule(const MPSCSchedule&) = delete;
+	MPSCSchedule& operator=(const MPSCSchedule&) = delete;
+
+	~MPSCSchedule() {
+		while (isValid()) {
+			next();
+		}
+	}
+
+	/**
+	 * @brief Queue an element. Safe to call from any number of threads.
+	 * 
+	 * @return Whether there was room. If not, element is left untouched, so it can be retried.
+	 */
+	bool enqueue(const T& element) {
+		return push(element);
+	}
+
+	bool enqueue(T&& element) {
+		return push(std::move(element));
+	}
+
+	/**
+	 * @brief The oldest element. Consumer only, and only while isValid().
+	 */
+	T& get() {
+		return *slots[head.load(std::memory_order_relaxed) & mask].element.get();
+	}
+
+	/**
+	 * @brief Consume the oldest element. Consumer only.
+	 * 
+	 * @return false if there was nothing to consume.
+	 */
+	bool next() {
+		if (!isValid()) {
+			std::cout << "An attempt was made to step past the end of the MPSCSchedule!" << std::endl;
+			return false;
+		}
+		std::size_t h = head.load(std::memory_order_relaxed);
+		Slot& slot = slots[h & mask];
+		std::destroy_at(slot.element.get());
+		// Hand the slot back to the producers, for when the counters come round to it again
+		slot.sequence.store(h + Capacity, std::memory_order_release);
+		head.store(h + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * @brief Whether there's a fully written element to get(). Consumer only.
+	 * Elements become visible in the order their slots were claimed, so a slow producer briefly holds back those behind it.
+	 */
+	bool isValid() {
+		std::size_t h = head.load(std::memory_order_relaxed);
+		return slots[h & mask].sequence.load(std::memory_order_acquire) == h + 1;
+	}
+
+	/**
+	 * @brief Number of queued elements, including ones still being written. Only a snapshot.
+	 */
+	int length() {
+		return static_cast<int>(tail.load(std::memory_order_relaxed) - head.load(std::memory_order_relaxed));
+	}
+
+	static constexpr std::size_t capacity() {
+		return Capacity;
+	}
+};
 };
-#endif
\ No newline at end of file
+#endif
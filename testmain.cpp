@@ -23,6 +23,8 @@
 #include <SFML/Graphics/Transform.hpp>
 #include <SFML/System/Vector2.hpp>
 
+#include <string>
+
 
 using namespace vnpge;
 
@@ -54,7 +56,22 @@ void print(Args&&... args) {
 	(std::cout <<  ... << args) << std::endl;
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+
+	// Compare word wrapping implementations on a long paragraph, without opening a window
+	if (argc > 1 && std::string{argv[1]} == "--bench-wrap") {
+		sf::Font font;
+		if (!font.loadFromFile("assets/fonts/BonaNova-Italic.ttf")) {
+			return 1;
+		}
+
+		std::string paragraph;
+		for (int i = 0; i < 200; i++) {
+			paragraph += "The quick brown fox jumps over the lazy dog, and  then   rests a while. ";
+		}
+		benchmarkWrap(font, 24, 800, paragraph, 10);
+		return 0;
+	}
 
 	// Construct window
 	SFMLWindow window;
@@ -79,7 +96,8 @@ int main() {
 																						.y = 0.75 }
 																		}
 														},
-									  []	 ()								  {return true; }, 
+									  // Drawn once and then reused; compositor.invalidate("text") after changing the text box has it drawn again
+									  []	 ()								  {return false; }, 
 										  	[&tb](sf::RenderTarget& renderTarget) {tb.render(renderTarget);}
 												};
 
@@ -113,6 +131,10 @@ int main() {
 			// "close requested" event: we close the window
 			if (event.type == sf::Event::Closed)
 				sfWindow.close();
+
+			// Areas follow the window; only those that change size class get new targets
+			if (event.type == sf::Event::Resized)
+				compositor.resize({.w = event.size.width, .h = event.size.height});
 		}
 		
 
@@ -123,4 +145,8 @@ int main() {
 
 		window.getWindow().display();	
 	}
+
+	AreaRenderStats stats = compositor.getTotalStats();
+	print("compositor: ", stats.redraws, " redraws, ", stats.reuses, " reuses");
+	print("render targets: ", compositor.getTargetPool().pageCount(), " pages, ", compositor.getTargetPool().getCreated(), " slots created, ", compositor.getTargetPool().getReused(), " reused");
 }
@@ -0,0 +1,61 @@
+#ifndef VNPGE_TEXT_ARENA_HEADER
+#define VNPGE_TEXT_ARENA_HEADER
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+
+namespace vnpge {
+
+/**
+ * @brief Location of a piece of text within a TextArena.
+ */
+struct TextSpan {
+	public:
+	std::uint32_t offset;
+	std::uint32_t length;
+};
+
+/**
+ * @brief Append-only storage for many small strings in one contiguous UTF-8 buffer.
+ * Each piece of text is one copy into the buffer rather than its own allocation, and the whole lot is freed at once.
+ * Views handed out by view() are only stable while appends stay within the reserved capacity,
+ * so reserve() the total size up front when building from a known set of strings.
+ */
+class TextArena {
+	private:
+	std::string buffer;
+
+	public:
+	TextArena() = default;
+
+	void reserve(std::size_t bytes) {
+		buffer.reserve(bytes);
+	}
+
+	TextSpan append(std::string_view text) {
+		if (buffer.size() + text.size() > UINT32_MAX) {
+			throw std::length_error("Text arena is full; a chapter can hold at most 4 GiB of dialogue");
+		}
+		TextSpan span = {static_cast<std::uint32_t>(buffer.size()), static_cast<std::uint32_t>(text.size())};
+		buffer.append(text);
+		return span;
+	}
+
+	std::string_view view(TextSpan span) const {
+		return std::string_view{buffer}.substr(span.offset, span.length);
+	}
+
+	std::size_t size() const {
+		return buffer.size();
+	}
+
+	std::size_t capacity() const {
+		return buffer.capacity();
+	}
+};
+
+}
+#endif
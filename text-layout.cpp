@@ -0,0 +1,528 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "structures.h"
+#include "text-layout.h"
+
+
+namespace vnpge {
+
+	char32_t decodeUTF8(std::string_view text, std::size_t& pos) {
+		auto byte = [&](std::size_t i) { return static_cast<unsigned char>(text[i]); };
+		unsigned char lead = byte(pos);
+
+		std::size_t length;
+		char32_t cp;
+		if (lead < 0x80) {
+			pos += 1;
+			return lead;
+		}
+		else if ((lead & 0xE0) == 0xC0) {
+			length = 2;
+			cp = lead & 0x1F;
+		}
+		else if ((lead & 0xF0) == 0xE0) {
+			length = 3;
+			cp = lead & 0x0F;
+		}
+		else if ((lead & 0xF8) == 0xF0) {
+			length = 4;
+			cp = lead & 0x07;
+		}
+		else {
+			pos += 1;
+			return U'�';
+		}
+
+		if (pos + length > text.size()) {
+			pos += 1;
+			return U'�';
+		}
+		for (std::size_t i = 1; i < length; i++) {
+			if ((byte(pos + i) & 0xC0) != 0x80) {
+				pos += 1;
+				return U'�';
+			}
+			cp = (cp << 6) | (byte(pos + i) & 0x3F);
+		}
+		pos += length;
+		return cp;
+	}
+
+
+	namespace {
+		struct Range {
+			public:
+			char32_t first;
+			char32_t last;
+		};
+
+		bool inRanges(char32_t cp, std::initializer_list<Range> ranges) {
+			return std::any_of(ranges.begin(), ranges.end(), [cp](const Range& r) { return cp >= r.first && cp <= r.last; });
+		}
+
+		// Combining marks and other code points that attach to whatever comes before them.
+		// The common blocks, rather than the whole of Grapheme_Cluster_Break=Extend
+		bool isExtend(char32_t cp) {
+			return inRanges(cp, {
+				{0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2}, {0x05C4, 0x05C5},
+				{0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4},
+				{0x0900, 0x0903}, {0x093A, 0x094F}, {0x0951, 0x0957}, {0x0962, 0x0963},
+				{0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E},
+				{0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF}, {0x200C, 0x200C}, {0x20D0, 0x20FF},
+				{0x302A, 0x302F}, {0x3099, 0x309A}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+				// Emoji skin tone modifiers
+				{0x1F3FB, 0x1F3FF},
+				{0xE0020, 0xE007F}, {0xE0100, 0xE01EF}
+			});
+		}
+
+		bool isPictographic(char32_t cp) {
+			return inRanges(cp, {{0x2600, 0x27BF}, {0x2B00, 0x2BFF}, {0x1F000, 0x1FAFF}});
+		}
+
+		bool isRegionalIndicator(char32_t cp) {
+			return cp >= 0x1F1E6 && cp <= 0x1F1FF;
+		}
+
+		bool isControl(char32_t cp) {
+			return cp < 0x20 || (cp >= 0x7F && cp < 0xA0) || cp == 0x2028 || cp == 0x2029;
+		}
+
+
+		// Line breaking classes from UAX #14, only the ones the rules below tell apart
+		enum struct BreakClass : std::uint8_t {
+			// Mandatory break after
+			BK,
+			// Space
+			SP,
+			// Zero width space
+			ZW,
+			// Word joiner
+			WJ,
+			// Non-breaking glue
+			GL,
+			// Break after
+			BA,
+			// Hyphen
+			HY,
+			// Opening punctuation
+			OP,
+			// Closing punctuation and parentheses
+			CL,
+			// Exclamation and interrogation
+			EX,
+			// Infix separator
+			IS,
+			// Nonstarter
+			NS,
+			// Numeric
+			NU,
+			// Ideographic
+			ID,
+			// Alphabetic, and everything else
+			AL
+		};
+
+		BreakClass classify(char32_t cp) {
+			switch (cp) {
+				case U'\n': case U'\r': case 0x0B: case 0x0C: case 0x85: case 0x2028: case 0x2029:
+					return BreakClass::BK;
+				case U' ':
+					return BreakClass::SP;
+				case 0x200B:
+					return BreakClass::ZW;
+				case 0x2060: case 0xFEFF:
+					return BreakClass::WJ;
+				case 0x00A0: case 0x202F: case 0x2007: case 0x034F: case 0x2011:
+					return BreakClass::GL;
+				case U'\t': case 0x00AD: case 0x2010: case 0x2012: case 0x2013: case U'|': case 0x2027:
+					return BreakClass::BA;
+				case U'-':
+					return BreakClass::HY;
+				case U'(': case U'[': case U'{': case 0x00A1: case 0x00BF: case 0x2018: case 0x201C: case 0x300C: case 0x300E: case 0xFF08:
+					return BreakClass::OP;
+				case U')': case U']': case U'}': case 0x2019: case 0x201D: case 0x3001: case 0x3002: case 0x300D: case 0x300F: case 0xFF09: case 0xFF0C: case 0xFF0E:
+					return BreakClass::CL;
+				case U'!': case U'?': case 0xFF01: case 0xFF1F:
+					return BreakClass::EX;
+				case U',': case U'.': case U':': case U';':
+					return BreakClass::IS;
+				case 0x3005: case 0x30FC: case 0x3041: case 0x3043: case 0x3045: case 0x3047: case 0x3049: case 0x3063: case 0x30A1: case 0x30A3: case 0x30A5: case 0x30A7: case 0x30A9: case 0x30C3:
+					return BreakClass::NS;
+			}
+			if (cp >= U'0' && cp <= U'9') {
+				return BreakClass::NU;
+			}
+			if (inRanges(cp, {
+				// Hiragana, katakana, CJK ideographs and compatibility ideographs, Hangul syllables, fullwidth forms
+				{0x3040, 0x30FF}, {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xF900, 0xFAFF}, {0xAC00, 0xD7A3}, {0xFF00, 0xFF60},
+				{0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+				// Emoji behave like ideographs
+				{0x1F300, 0x1FAFF}
+			})) {
+				return BreakClass::ID;
+			}
+			return BreakClass::AL;
+		}
+	}
+
+
+	std::vector<TextCluster> segmentGraphemes(std::string_view text) {
+		std::vector<TextCluster> clusters;
+		clusters.reserve(text.size());
+
+		char32_t previous = 0;
+		// Whether the cluster so far ends in pictographic (ZWJ)?, for joining emoji sequences
+		bool pictographic = false;
+		std::size_t regionalIndicators = 0;
+
+		for (std::size_t pos = 0; pos < text.size();) {
+			std::size_t offset = pos;
+			char32_t cp = decodeUTF8(text, pos);
+
+			bool join = false;
+			if (!clusters.empty()) {
+				if (previous == U'\r' && cp == U'\n') {
+					join = true;
+				}
+				else if (isControl(previous) || isControl(cp)) {
+					join = false;
+				}
+				else if (isExtend(cp) || cp == 0x200D) {
+					join = true;
+				}
+				else if (previous == 0x200D && pictographic && isPictographic(cp)) {
+					join = true;
+				}
+				else if (isRegionalIndicator(previous) && isRegionalIndicator(cp) && regionalIndicators % 2 == 1) {
+					join = true;
+				}
+			}
+
+			if (join) {
+				clusters.back().length = static_cast<std::uint32_t>(pos - clusters.back().offset);
+			}
+			else {
+				clusters.push_back({static_cast<std::uint32_t>(offset), static_cast<std::uint32_t>(pos - offset), cp});
+				pictographic = false;
+				regionalIndicators = 0;
+			}
+
+			if (isPictographic(cp)) {
+				pictographic = true;
+			}
+			regionalIndicators = isRegionalIndicator(cp) ? regionalIndicators + 1 : 0;
+			previous = cp;
+		}
+		return clusters;
+	}
+
+
+	std::vector<LineBreak> findLineBreaks(const std::vector<TextCluster>& clusters) {
+		std::vector<LineBreak> breaks(clusters.size(), LineBreak::none);
+
+		// Class of the last cluster that wasn't a space, and whether there have been spaces since
+		BreakClass beforeSpaces = BreakClass::AL;
+		bool spaces = false;
+
+		for (std::size_t i = 0; i < clusters.size(); i++) {
+			BreakClass cur = classify(clusters[i].base);
+			if (i == 0) {
+				// LB2: never break at the start of text
+				beforeSpaces = cur;
+				continue;
+			}
+			BreakClass prev = classify(clusters[i - 1].base);
+
+			LineBreak result = [&] {
+				using enum BreakClass;
+				// LB4, LB5: always break after hard line breaks (CR LF is already one cluster)
+				if (prev == BK) {
+					return LineBreak::mandatory;
+				}
+				// LB6, LB7: don't break before hard line breaks, spaces or zero width spaces
+				if (cur == BK || cur == SP || cur == ZW) {
+					return LineBreak::none;
+				}
+				// LB8: break after zero width space, even with spaces in between
+				if (beforeSpaces == ZW) {
+					return LineBreak::allowed;
+				}
+				// LB11, LB12: don't break around word joiners, or after glue
+				if (prev == WJ || cur == WJ || prev == GL) {
+					return LineBreak::none;
+				}
+				// LB12a: don't break before glue, unless after spaces and hyphens
+				if (cur == GL && prev != SP && prev != BA && prev != HY) {
+					return LineBreak::none;
+				}
+				// LB13: don't break before closing punctuation, even after spaces
+				if (cur == CL || cur == EX || cur == IS) {
+					return LineBreak::none;
+				}
+				// LB14: don't break after opening punctuation, even before spaces
+				if (beforeSpaces == OP) {
+					return LineBreak::none;
+				}
+				// LB18: break after spaces
+				if (spaces) {
+					return LineBreak::allowed;
+				}
+				// LB21: don't break before hyphens and other break-after characters, or before nonstarters
+				if (cur == BA || cur == HY || cur == NS) {
+					return LineBreak::none;
+				}
+				// LB25 (simplified): keep numbers together, like -1 and 3.14
+				if ((prev == HY || prev == IS) && cur == NU) {
+					return LineBreak::none;
+				}
+				// LB23, LB28: don't break within words and numbers
+				if ((prev == AL || prev == NU) && (cur == AL || cur == NU)) {
+					return LineBreak::none;
+				}
+				// LB30: don't break between words and parentheses around them
+				if ((prev == AL || prev == NU) && cur == OP) {
+					return LineBreak::none;
+				}
+				if (prev == CL && (cur == AL || cur == NU)) {
+					return LineBreak::none;
+				}
+				// LB31: break everywhere else
+				return LineBreak::allowed;
+			}();
+			breaks[i] = result;
+
+			if (cur == BreakClass::SP) {
+				spaces = true;
+			}
+			else {
+				beforeSpaces = cur;
+				spaces = false;
+			}
+		}
+		return breaks;
+	}
+
+
+	AdvanceTable::AdvanceTable(AdvanceFunc advance, KerningFunc kerning, float lineHeight)
+	: measureAdvance{std::move(advance)}, measureKerning{std::move(kerning)}, lineHeight{lineHeight} {
+		for (char32_t cp = 0; cp < ascii.size(); cp++) {
+			ascii[cp] = measureAdvance(cp);
+		}
+	}
+
+	float AdvanceTable::advance(char32_t cp) {
+		if (cp < ascii.size()) {
+			return ascii[cp];
+		}
+
+		{
+			std::shared_lock lock{mutex};
+			if (auto it = advances.find(cp); it != advances.end()) {
+				return it->second;
+			}
+		}
+
+		std::unique_lock lock{mutex};
+		return advances.try_emplace(cp, measureAdvance(cp)).first->second;
+	}
+
+	float AdvanceTable::kerning(char32_t previous, char32_t cp) {
+		std::uint64_t key = (static_cast<std::uint64_t>(previous) << 32) | cp;
+		{
+			std::shared_lock lock{mutex};
+			if (auto it = kernings.find(key); it != kernings.end()) {
+				return it->second;
+			}
+		}
+
+		std::unique_lock lock{mutex};
+		return kernings.try_emplace(key, measureKerning(previous, cp)).first->second;
+	}
+
+
+	ParagraphLayout layoutParagraph(std::string_view text, AdvanceTable& metrics, float maxWidth) {
+		std::vector<TextCluster> clusters = segmentGraphemes(text);
+		std::vector<LineBreak> breaks = findLineBreaks(clusters);
+
+		ParagraphLayout layout;
+		layout.lineHeight = metrics.getLineHeight();
+		layout.clusters.reserve(clusters.size());
+		if (!text.empty()) {
+			layout.lineStarts.push_back(0);
+		}
+
+		float x = 0;
+		// Width of the line without any trailing spaces
+		float inkWidth = 0;
+		std::uint32_t line = 0;
+		// Where the current line starts, and the last place on it that it may be broken
+		std::size_t lineStart = 0;
+		std::size_t lastBreak = 0;
+		// What the line's width would be if broken there
+		float inkAtBreak = 0;
+		char32_t previous = 0;
+
+		auto endLine = [&](std::size_t next, float nextX) {
+			layout.width = std::max(layout.width, inkWidth);
+			line++;
+			lineStart = next;
+			lastBreak = next;
+			layout.lineStarts.push_back(next < clusters.size() ? clusters[next].offset : static_cast<std::uint32_t>(text.size()));
+			x = nextX;
+			inkWidth = 0;
+		};
+
+		for (std::size_t i = 0; i < clusters.size(); i++) {
+			const TextCluster& cluster = clusters[i];
+
+			if (breaks[i] == LineBreak::mandatory) {
+				endLine(i, 0);
+				previous = 0;
+			}
+			else if (breaks[i] == LineBreak::allowed) {
+				lastBreak = i;
+				inkAtBreak = inkWidth;
+			}
+
+			// Everything in a cluster is drawn one after the other, but measured as a unit
+			float advance = 0;
+			char32_t last = cluster.base;
+			for (std::size_t pos = cluster.offset; pos < cluster.offset + cluster.length;) {
+				last = decodeUTF8(text, pos);
+				advance += metrics.advance(last);
+			}
+
+			char32_t base = cluster.base;
+			bool blank = base == U' ' || base == U'\t' || base == U'\n' || base == U'\r' || base == 0x200B;
+			if (blank) {
+				// Spaces may hang off the end of a line
+				advance = (base == U' ' || base == U'\t') ? advance : 0;
+			}
+			else {
+				float kern = previous ? metrics.kerning(previous, base) : 0;
+
+				if (x + kern + advance > maxWidth && x > 0) {
+					if (lastBreak == i) {
+						// This cluster is itself a break opportunity; start the next line with it
+						endLine(i, 0);
+						kern = 0;
+					}
+					else if (lastBreak > lineStart) {
+						// Carry everything since the last break opportunity down to the next line
+						float shift = layout.clusters[lastBreak].x;
+						std::size_t carried = lastBreak;
+						inkWidth = inkAtBreak;
+						endLine(carried, x - shift);
+						for (std::size_t j = carried; j < i; j++) {
+							layout.clusters[j].x -= shift;
+							layout.clusters[j].line = line;
+						}
+						// The carried clusters are all ink, or they'd have offered a break after them
+						inkWidth = x;
+					}
+					else {
+						// No break opportunity on the whole line; break mid-word rather than run off the edge
+						endLine(i, 0);
+						kern = 0;
+					}
+				}
+				x += kern;
+			}
+
+			layout.clusters.push_back({cluster.offset, cluster.length, x, line});
+			x += advance;
+			if (!blank) {
+				inkWidth = x;
+			}
+			previous = last;
+		}
+
+		layout.width = std::max(layout.width, inkWidth);
+		return layout;
+	}
+
+
+	ParagraphLayout placeLines(std::string_view text, AdvanceTable& metrics, std::span<const std::uint32_t> lineStarts) {
+		std::vector<TextCluster> clusters = segmentGraphemes(text);
+
+		ParagraphLayout layout;
+		layout.lineHeight = metrics.getLineHeight();
+		layout.lineStarts.assign(lineStarts.begin(), lineStarts.end());
+		layout.clusters.reserve(clusters.size());
+
+		float x = 0;
+		float inkWidth = 0;
+		std::size_t line = 0;
+		char32_t previous = 0;
+
+		for (const TextCluster& cluster : clusters) {
+			if (line + 1 < lineStarts.size() && cluster.offset >= lineStarts[line + 1]) {
+				layout.width = std::max(layout.width, inkWidth);
+				while (line + 1 < lineStarts.size() && cluster.offset >= lineStarts[line + 1]) {
+					line++;
+				}
+				x = 0;
+				inkWidth = 0;
+				previous = 0;
+			}
+
+			float advance = 0;
+			char32_t last = cluster.base;
+			for (std::size_t pos = cluster.offset; pos < cluster.offset + cluster.length;) {
+				last = decodeUTF8(text, pos);
+				advance += metrics.advance(last);
+			}
+
+			char32_t base = cluster.base;
+			bool blank = base == U' ' || base == U'\t' || base == U'\n' || base == U'\r' || base == 0x200B;
+			if (blank) {
+				advance = (base == U' ' || base == U'\t') ? advance : 0;
+			}
+			else if (previous && x > 0) {
+				x += metrics.kerning(previous, base);
+			}
+
+			layout.clusters.push_back({cluster.offset, cluster.length, x, static_cast<std::uint32_t>(line)});
+			x += advance;
+			if (!blank) {
+				inkWidth = x;
+			}
+			previous = last;
+		}
+
+		layout.width = std::max(layout.width, inkWidth);
+		return layout;
+	}
+
+
+	std::string insertLineBreaks(std::string_view text, const ParagraphLayout& layout) {
+		return insertLineBreaks(text, layout.lineStarts);
+	}
+
+	std::string insertLineBreaks(std::string_view text, std::span<const std::uint32_t> lineStarts) {
+		std::string result;
+		result.reserve(text.size() + lineStarts.size());
+
+		std::size_t copied = 0;
+		for (std::size_t i = 1; i < lineStarts.size(); i++) {
+			std::size_t start = lineStarts[i];
+			result.append(text.substr(copied, start - copied));
+			copied = start;
+			// Lines that already end in a hard break don't need another
+			if (start > 0 && text[start - 1] != '\n' && text[start - 1] != '\r') {
+				result.push_back('\n');
+			}
+		}
+		result.append(text.substr(copied));
+		return result;
+	}
+}
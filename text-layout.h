@@ -0,0 +1,164 @@
+#ifndef VNPGE_TEXT_LAYOUT_HEADER
+#define VNPGE_TEXT_LAYOUT_HEADER
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "structures.h"
+
+
+namespace vnpge {
+
+/**
+ * @brief Decode the next code point of a UTF-8 string, advancing pos past it.
+ * Malformed sequences come out as U+FFFD, one byte at a time.
+ */
+char32_t decodeUTF8(std::string_view text, std::size_t& pos);
+
+/**
+ * @brief A user-perceived character: a base code point plus any combining marks, variation selectors,
+ * emoji modifiers or zero-width-joined pieces that belong with it. Never split across lines.
+ */
+struct TextCluster {
+	public:
+	// Byte range within the text
+	std::uint32_t offset;
+	std::uint32_t length;
+	// First code point of the cluster; what line breaking classifies it by
+	char32_t base;
+};
+
+/**
+ * @brief Split UTF-8 text into grapheme clusters.
+ * Follows the parts of UAX #29 that matter for dialogue: CR LF, combining marks and other extenders,
+ * zero width joiner sequences and regional indicator pairs. Hangul jamo sequences and Indic conjuncts aren't joined.
+ */
+std::vector<TextCluster> segmentGraphemes(std::string_view text);
+
+
+enum struct LineBreak : std::uint8_t {
+	// The line may not be broken before this cluster
+	none,
+	// The line may be broken before this cluster, if it doesn't fit
+	allowed,
+	// The line must be broken before this cluster
+	mandatory
+};
+
+/**
+ * @brief Find where lines may and must be broken, before each cluster.
+ * Implements the core of UAX #14's pair rules: mandatory breaks, spaces, glue and word joiners, zero width spaces,
+ * opening and closing punctuation, hyphens, numbers, and ideographs (which may be broken between).
+ */
+std::vector<LineBreak> findLineBreaks(const std::vector<TextCluster>& clusters);
+
+
+/**
+ * @brief Cached glyph advances and kerning for one font at one size, measured through whatever the backend provides.
+ * ASCII advances are measured up front; anything else on first use.
+ * Safe to use from several threads at once, as long as the measuring functions are safe to call from whichever thread misses.
+ */
+class AdvanceTable {
+	public:
+	using AdvanceFunc = std::function<float(char32_t)>;
+	using KerningFunc = std::function<float(char32_t, char32_t)>;
+
+	private:
+	AdvanceFunc measureAdvance;
+	KerningFunc measureKerning;
+	float lineHeight;
+
+	std::array<float, 128> ascii;
+
+	mutable std::shared_mutex mutex;
+	std::unordered_map<char32_t, float> advances;
+	std::unordered_map<std::uint64_t, float> kernings;
+
+	public:
+	/**
+	 * @brief Construct a new AdvanceTable.
+	 *
+	 * @param advance Measures a code point's advance, in pixels.
+	 * @param kerning Measures the kerning adjustment between two code points, in pixels.
+	 * @param lineHeight Distance from one line's top to the next one's.
+	 */
+	AdvanceTable(AdvanceFunc advance, KerningFunc kerning, float lineHeight);
+
+	AdvanceTable(const AdvanceTable&) = delete;
+	AdvanceTable& operator=(const AdvanceTable&) = delete;
+
+	float advance(char32_t cp);
+
+	float kerning(char32_t previous, char32_t cp);
+
+	float getLineHeight() const {
+		return lineHeight;
+	}
+};
+
+
+/**
+ * @brief A cluster placed on a line.
+ */
+struct PlacedCluster {
+	public:
+	std::uint32_t offset;
+	std::uint32_t length;
+	// Left edge, relative to the start of the line
+	float x;
+	std::uint32_t line;
+};
+
+/**
+ * @brief Text broken into lines, with every cluster positioned; enough for any backend to draw it from.
+ */
+struct ParagraphLayout {
+	public:
+	std::vector<PlacedCluster> clusters;
+	// Byte offset into the text at which each line starts, the first one included
+	std::vector<std::uint32_t> lineStarts;
+	// Width of the widest line, not counting spaces at line ends
+	float width = 0;
+	float lineHeight = 0;
+
+	std::size_t lineCount() const {
+		return lineStarts.size();
+	}
+
+	float height() const {
+		return lineStarts.size() * lineHeight;
+	}
+};
+
+/**
+ * @brief Lay text out in lines no wider than maxWidth, breaking only where findLineBreaks allows.
+ * Clusters wider than a whole line, or runs of them with no break opportunity, are broken wherever they run out of room.
+ * Spaces at the end of a line don't count towards its width.
+ */
+ParagraphLayout layoutParagraph(std::string_view text, AdvanceTable& metrics, float maxWidth);
+
+/**
+ * @brief Position text's clusters on lines that were already broken, by an earlier layoutParagraph for instance.
+ * Makes no break decisions of its own, so it's the cheap half of a layout.
+ *
+ * @param lineStarts Byte offset at which each line starts, as in ParagraphLayout::lineStarts.
+ */
+ParagraphLayout placeLines(std::string_view text, AdvanceTable& metrics, std::span<const std::uint32_t> lineStarts);
+
+/**
+ * @brief Copy of text with a newline inserted at each line start the layout added, for backends that wrap on newlines only.
+ */
+std::string insertLineBreaks(std::string_view text, const ParagraphLayout& layout);
+
+std::string insertLineBreaks(std::string_view text, std::span<const std::uint32_t> lineStarts);
+
+}
+#endif
@@ -1,9 +1,13 @@
+#include <algorithm>
 #include <stdexcept>
 #include <vector>
-#include <queue>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <functional>
+#include <span>
+#include <unordered_map>
+#include <utility>
 
 #include <cassert>
 
@@ -12,43 +16,6 @@
 
 namespace trees {
 
-	using ApplyFunction = std::function<void(const OrderNode& node)>;
-
-	std::optional<std::reference_wrapper<const OrderNode>> dfs(const OrderNode& node, std::string_view id, ApplyFunction f) {
-		
-		f(node);
-		if (node.id == id) {
-			return node;
-		}
-
-		for (auto& subNode : node.subNodes) {	
-			if (auto result = dfs(subNode, id, f)) {
-				return result;
-			}
-		}
-		return std::nullopt;
-	}
-
-	std::optional<std::reference_wrapper<const OrderNode>> bfs(const OrderNode& node, std::string_view id, ApplyFunction f) {
-		std::queue<std::reference_wrapper<const OrderNode>> q{};
-
-		q.push(node);
-		while (!q.empty()) {
-			auto n = q.front();
-			q.pop();
-
-			f(n);
-			
-			if (n.get().id == id) {
-				return n;
-			}
-			for (auto& m : n.get().subNodes) {
-				q.push(m);
-			}
-		}
-		return std::nullopt;
-	}
-	
 	std::string prettifyTree(OrderNode& root) {
 		std::string retval{""};
 		dfs(root, "", [&retval](const OrderNode& n) {
@@ -81,30 +48,361 @@ namespace trees {
 
 	
 	
-	OrderNode buildTree(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId) {
-		OrderNode root{rootId};
-		
-		std::vector<std::vector<std::string_view>> lineages;
-		for (auto& p : m) {
-			std::vector<std::string_view> lineage;
-			
-			std::string_view curId = p.first;
-			while (true) {
-				lineage.push_back(curId);
-				if (curId == rootId) {
-					break;
+	namespace {
+		/**
+		 * @brief A parent map turned into child lists: node i's children are children[childStart[i]] up to children[childStart[i + 1]].
+		 * Node 0 is the root; the rest are numbered in the map's iteration order.
+		 */
+		struct ChildLists {
+			public:
+			std::vector<std::string_view> ids;
+			std::vector<std::uint32_t> childStart;
+			std::vector<std::uint32_t> children;
+		};
+
+		ChildLists groupChildren(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId) {
+			if (m.size() >= UINT32_MAX) {
+				throw std::length_error("Parent map is too large to build a tree from");
+			}
+
+			ChildLists lists;
+			lists.ids.reserve(m.size() + 1);
+			lists.ids.push_back(rootId);
+
+			std::unordered_map<std::string_view, std::uint32_t> index;
+			index.reserve(m.size() + 1);
+			index.emplace(rootId, 0);
+			for (const auto& [id, parentId] : m) {
+				// The root may map to anything; it's the root regardless
+				if (id != rootId) {
+					index.emplace(id, static_cast<std::uint32_t>(lists.ids.size()));
+					lists.ids.push_back(id);
+				}
+			}
+
+			std::uint32_t count = static_cast<std::uint32_t>(lists.ids.size());
+			std::vector<std::uint32_t> parents(count, 0);
+			for (std::uint32_t i = 1; i < count; i++) {
+				std::string_view parentId = m.find(lists.ids[i])->second;
+				auto parent = index.find(parentId);
+				if (parent == index.end()) {
+					throw std::invalid_argument("Cannot build tree: parent '" + std::string{parentId} + "' of '" + std::string{lists.ids[i]} + "' does not exist");
+				}
+				parents[i] = parent->second;
+			}
+
+			// Counting sort by parent: count each parent's children, turn the counts into starting points, then drop every child into place
+			lists.childStart.assign(count + 1, 0);
+			for (std::uint32_t i = 1; i < count; i++) {
+				lists.childStart[parents[i] + 1]++;
+			}
+			for (std::uint32_t i = 0; i < count; i++) {
+				lists.childStart[i + 1] += lists.childStart[i];
+			}
+			lists.children.resize(count - 1);
+			std::vector<std::uint32_t> fill{lists.childStart.begin(), lists.childStart.end() - 1};
+			for (std::uint32_t i = 1; i < count; i++) {
+				lists.children[fill[parents[i]]++] = i;
+			}
+
+			// Every node reachable from the root is found by walking down from it; anything left over hangs off a cycle.
+			// Walking up from a leftover node has to come round to a node it's already seen, and that one's on the cycle
+			std::vector<bool> reached(count, false);
+			std::uint32_t reachedCount = 0;
+			SmallStack<std::uint32_t> pending;
+			pending.push(0);
+			while (!pending.empty()) {
+				std::uint32_t n = pending.pop();
+				reached[n] = true;
+				reachedCount++;
+				for (std::uint32_t c = lists.childStart[n]; c < lists.childStart[n + 1]; c++) {
+					pending.push(lists.children[c]);
 				}
-				curId = m.at(curId);
 			}
-			auto reversedLineage = r_wrap(lineage);
-			lineages.emplace_back(reversedLineage.begin(), reversedLineage.end());
+			if (reachedCount != count) {
+				std::uint32_t n = static_cast<std::uint32_t>(std::find(reached.begin(), reached.end(), false) - reached.begin());
+				while (!reached[n]) {
+					reached[n] = true;
+					n = parents[n];
+				}
+				throw std::invalid_argument("Cannot build tree: '" + std::string{lists.ids[n]} + "' is its own ancestor");
+			}
+
+			return lists;
 		}
+	}
 
-		for (auto& lineage : lineages) {
-			buildBranch(root, lineage);
+	OrderNode buildTree(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId) {
+		ChildLists lists = groupChildren(m, rootId);
+
+		OrderNode root{rootId};
+		struct Pending {
+			OrderNode* node;
+			std::uint32_t index;
+		};
+		SmallStack<Pending> pending;
+		pending.push({&root, 0});
+		while (!pending.empty()) {
+			auto [node, n] = pending.pop();
+			// Room for every child up front, so the pointers to them on the stack stay good
+			node->subNodes.reserve(lists.childStart[n + 1] - lists.childStart[n]);
+			for (std::uint32_t c = lists.childStart[n]; c < lists.childStart[n + 1]; c++) {
+				node->subNodes.emplace_back(lists.ids[lists.children[c]]);
+			}
+			for (std::uint32_t c = lists.childStart[n]; c < lists.childStart[n + 1]; c++) {
+				pending.push({&node->subNodes[c - lists.childStart[n]], lists.children[c]});
+			}
 		}
-		
 		return root;
 	}
 	
-}
\ No newline at end of file
+
+
+	FlatTree::FlatTree(const OrderNode& root) {
+		struct Pending {
+			const OrderNode* node;
+			std::uint32_t parent;
+		};
+		SmallStack<Pending> pending;
+		pending.push({&root, none});
+		while (!pending.empty()) {
+			auto [node, parent] = pending.pop();
+			std::uint32_t n = static_cast<std::uint32_t>(nodes.size());
+			append(node->id, parent);
+			for (auto child = node->subNodes.rbegin(); child != node->subNodes.rend(); ++child) {
+				pending.push({&*child, n});
+			}
+		}
+		closeSubtrees();
+	}
+
+	FlatTree::FlatTree(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId) {
+		ChildLists lists = groupChildren(m, rootId);
+
+		std::size_t idBytes = 0;
+		for (std::string_view id : lists.ids) {
+			idBytes += id.size();
+		}
+		nodes.reserve(lists.ids.size());
+		ids.reserve(idBytes);
+
+		struct Pending {
+			std::uint32_t index;
+			std::uint32_t parent;
+		};
+		SmallStack<Pending> pending;
+		pending.push({0, none});
+		while (!pending.empty()) {
+			auto [n, parent] = pending.pop();
+			std::uint32_t position = static_cast<std::uint32_t>(nodes.size());
+			append(lists.ids[n], parent);
+			// Last child first, so the first comes off the stack first
+			for (std::uint32_t c = lists.childStart[n + 1]; c-- > lists.childStart[n]; ) {
+				pending.push({lists.children[c], position});
+			}
+		}
+		closeSubtrees();
+	}
+
+	void FlatTree::append(std::string_view id, std::uint32_t parent) {
+		if (nodes.size() >= none || ids.size() + id.size() > UINT32_MAX) {
+			throw std::length_error("Tree is too large to flatten");
+		}
+		std::uint32_t depth = parent == none ? 0 : nodes[parent].depth + 1;
+		std::uint32_t n = static_cast<std::uint32_t>(nodes.size());
+		nodes.push_back({.idOffset = static_cast<std::uint32_t>(ids.size()), .idLength = static_cast<std::uint32_t>(id.size()),
+		                 .parent = parent, .subtreeEnd = n + 1, .depth = depth});
+		ids.append(id);
+	}
+
+	void FlatTree::closeSubtrees() {
+		// Children come after their parents, so going backwards every subtree is finished before its parent's
+		for (std::size_t i = nodes.size(); i-- > 0; ) {
+			if (std::uint32_t parent = nodes[i].parent; parent != none) {
+				nodes[parent].subtreeEnd = std::max(nodes[parent].subtreeEnd, nodes[i].subtreeEnd);
+			}
+		}
+	}
+
+	std::uint32_t FlatTree::find(std::string_view id) const {
+		for (std::uint32_t i = 0; i < nodes.size(); i++) {
+			if (this->id(i) == id) {
+				return i;
+			}
+		}
+		return none;
+	}
+
+
+
+	LayerGraph::LayerGraph(std::string_view rootId) {
+		auto [it, inserted] = index.emplace(std::string{rootId}, 0);
+		nodes.push_back({.id = &it->first, .parent = none, .prev = none, .next = none, .last = 0});
+		root = 0;
+	}
+
+	std::uint32_t LayerGraph::link(std::string_view id, std::uint32_t parent) {
+		std::uint32_t n;
+		if (freeSlots.empty()) {
+			n = static_cast<std::uint32_t>(nodes.size());
+			nodes.emplace_back();
+		}
+		else {
+			n = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		auto it = index.emplace(std::string{id}, n).first;
+
+		// Straight after everything already on the parent, so it's drawn over all of that
+		std::uint32_t after = nodes[parent].last;
+		std::uint32_t before = nodes[after].next;
+		nodes[n] = {.id = &it->first, .parent = parent, .prev = after, .next = before, .last = n};
+		nodes[after].next = n;
+		if (before != none) {
+			nodes[before].prev = n;
+		}
+
+		// Every ancestor whose subtree ended where this one was put now ends with it
+		for (std::uint32_t a = parent; a != none && nodes[a].last == after; a = nodes[a].parent) {
+			nodes[a].last = n;
+		}
+
+		orderValid = false;
+		return n;
+	}
+
+	void LayerGraph::add(std::string_view id, std::string_view parentId) {
+		auto parent = index.find(parentId);
+		if (parent == index.end()) {
+			throw std::invalid_argument("Cannot add layer '" + std::string{id} + "': parent '" + std::string{parentId} + "' does not exist");
+		}
+		if (contains(id)) {
+			throw std::invalid_argument("Cannot add layer '" + std::string{id} + "': a layer with that id already exists");
+		}
+		link(id, parent->second);
+	}
+
+	void LayerGraph::add(std::span<const std::pair<std::string_view, std::string_view>> layers) {
+		// Check everything before touching the graph, so a bad batch adds nothing
+		std::unordered_map<std::string_view, std::vector<std::size_t>> waiting;
+		std::unordered_map<std::string_view, std::size_t> batchIds;
+		for (std::size_t i = 0; i < layers.size(); i++) {
+			auto [id, parentId] = layers[i];
+			if (contains(id) || !batchIds.emplace(id, i).second) {
+				throw std::invalid_argument("Cannot add layer '" + std::string{id} + "': a layer with that id already exists");
+			}
+		}
+
+		// Layers whose parents are already in the graph can go in straight away; the rest wait for their parents.
+		// Anything still waiting at the end has a parent that never turns up, or is part of a cycle
+		std::vector<std::size_t> ready;
+		for (std::size_t i = 0; i < layers.size(); i++) {
+			if (contains(layers[i].second)) {
+				ready.push_back(i);
+			}
+			else if (batchIds.contains(layers[i].second)) {
+				waiting[layers[i].second].push_back(i);
+			}
+			else {
+				throw std::invalid_argument("Cannot add layer '" + std::string{layers[i].first} + "': parent '" + std::string{layers[i].second} + "' does not exist");
+			}
+		}
+
+		std::size_t reachable = 0;
+		std::vector<std::size_t> stack{ready.rbegin(), ready.rend()};
+		while (!stack.empty()) {
+			std::size_t i = stack.back();
+			stack.pop_back();
+			reachable++;
+			if (auto it = waiting.find(layers[i].first); it != waiting.end()) {
+				stack.insert(stack.end(), it->second.rbegin(), it->second.rend());
+			}
+		}
+		if (reachable != layers.size()) {
+			throw std::invalid_argument("Cannot add layers: some of them are each other's ancestors");
+		}
+
+		// Same walk again, now that it's known to succeed
+		stack.assign(ready.rbegin(), ready.rend());
+		while (!stack.empty()) {
+			std::size_t i = stack.back();
+			stack.pop_back();
+			link(layers[i].first, index.find(layers[i].second)->second);
+			if (auto it = waiting.find(layers[i].first); it != waiting.end()) {
+				stack.insert(stack.end(), it->second.rbegin(), it->second.rend());
+			}
+		}
+	}
+
+	void LayerGraph::remove(std::string_view id, const std::function<void(std::string_view)>& onRemoved) {
+		auto it = index.find(id);
+		if (it == index.end()) {
+			return;
+		}
+		std::uint32_t n = it->second;
+		if (n == root) {
+			throw std::invalid_argument("Cannot remove the root of a layer graph");
+		}
+
+		// The subtree is one contiguous run in draw order; cut it out
+		std::uint32_t first = n;
+		std::uint32_t last = nodes[n].last;
+		std::uint32_t before = nodes[first].prev;
+		std::uint32_t after = nodes[last].next;
+		nodes[before].next = after;
+		if (after != none) {
+			nodes[after].prev = before;
+		}
+
+		for (std::uint32_t a = nodes[n].parent; a != none && nodes[a].last == last; a = nodes[a].parent) {
+			nodes[a].last = before;
+		}
+
+		for (std::uint32_t m = first; m != after; ) {
+			std::uint32_t next = nodes[m].next;
+			if (onRemoved) {
+				onRemoved(*nodes[m].id);
+			}
+			index.erase(index.find(*nodes[m].id));
+			freeSlots.push_back(m);
+			m = next;
+		}
+
+		orderValid = false;
+	}
+
+	std::string_view LayerGraph::parentOf(std::string_view id) const {
+		auto it = index.find(id);
+		if (it == index.end()) {
+			throw std::out_of_range("No layer '" + std::string{id} + "' in the layer graph");
+		}
+		std::uint32_t parent = nodes[it->second].parent;
+		return parent == none ? std::string_view{} : std::string_view{*nodes[parent].id};
+	}
+
+	const std::vector<std::string_view>& LayerGraph::drawOrder() {
+		if (!orderValid) {
+			order.clear();
+			for (std::uint32_t n = nodes[root].next; n != none; n = nodes[n].next) {
+				order.push_back(*nodes[n].id);
+			}
+			orderValid = true;
+		}
+		return order;
+	}
+
+	FlatTree LayerGraph::flatten() const {
+		FlatTree flat;
+		flat.nodes.reserve(index.size());
+
+		// Where each node ended up in the flat tree, so children can find their parents
+		std::vector<std::uint32_t> position(nodes.size(), FlatTree::none);
+		for (std::uint32_t n = root; n != none; n = nodes[n].next) {
+			std::uint32_t parent = nodes[n].parent;
+			position[n] = static_cast<std::uint32_t>(flat.size());
+			flat.append(*nodes[n].id, parent == none ? FlatTree::none : position[parent]);
+		}
+		flat.closeSubtrees();
+		return flat;
+	}
+}
@@ -1,13 +1,21 @@
 #ifndef VNPGE_TREE_HEADER
 #define VNPGE_TREE_HEADER
 
+#include <algorithm>
+#include <array>
 #include <stdexcept>
+#include <type_traits>
 #include <vector>
 #include <queue>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <functional>
 #include <concepts>
+#include <cstdint>
+#include <span>
+#include <unordered_map>
+#include <utility>
 
 #include <cassert>
 
@@ -27,9 +35,176 @@ namespace trees {
 
 	using ApplyFunction = std::function<void(const OrderNode& node)>;
 
-	std::optional<std::reference_wrapper<const OrderNode>> dfs(const OrderNode& node, std::string_view id, ApplyFunction f = [](auto){});
 
-	std::optional<std::reference_wrapper<const OrderNode>> bfs(const OrderNode& node, std::string_view id, ApplyFunction f = [](auto) {});
+	/**
+	 * @brief What a traversal does after visiting a node. Visitors may also return nothing, which means proceed.
+	 */
+	enum class Visit {
+		proceed,
+		// Carry on, but not into this node's children
+		skipChildren,
+		stop
+	};
+
+	namespace detail {
+		template <typename Visitor, typename Node>
+		Visit invokeVisitor(Visitor& visit, const Node& node) {
+			if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, const Node&>>) {
+				std::invoke(visit, node);
+				return Visit::proceed;
+			}
+			else {
+				return std::invoke(visit, node);
+			}
+		}
+	}
+
+
+	/**
+	 * @brief A stack that keeps its first N elements inline, and only goes to the heap beyond that.
+	 * Meant for the cheap handles traversals keep track of, like pointers and indices.
+	 */
+	template <typename T, std::size_t N = 32>
+	class SmallStack {
+		static_assert(std::is_trivially_copyable_v<T>, "SmallStack is only for cheap handles");
+
+		private:
+		std::array<T, N> local;
+		std::vector<T> spill;
+		std::size_t count = 0;
+
+		public:
+		void push(T value) {
+			if (count < N) {
+				local[count] = value;
+			}
+			else {
+				spill.push_back(value);
+			}
+			count++;
+		}
+
+		T pop() {
+			count--;
+			if (count < N) {
+				return local[count];
+			}
+			T value = spill.back();
+			spill.pop_back();
+			return value;
+		}
+
+		// Elements from the bottom up
+		const T& operator[](std::size_t i) const {
+			return i < N ? local[i] : spill[i - N];
+		}
+
+		bool empty() const {
+			return count == 0;
+		}
+
+		std::size_t size() const {
+			return count;
+		}
+
+		// Keeps any heap storage for reuse
+		void clear() {
+			count = 0;
+			spill.clear();
+		}
+	};
+
+
+	/**
+	 * @brief Visit a tree depth first, each node before its children, without recursing.
+	 * The visitor is inlined rather than type-erased, and can skip a node's children or stop the traversal.
+	 * Nothing is allocated unless more than 32 nodes are pending at once.
+	 *
+	 * @return The node the visitor stopped at, or nullptr if it visited everything.
+	 */
+	template <typename Visitor>
+	const OrderNode* preorder(const OrderNode& root, Visitor&& visit) {
+		SmallStack<const OrderNode*> pending;
+		pending.push(&root);
+		while (!pending.empty()) {
+			const OrderNode* node = pending.pop();
+			Visit next = detail::invokeVisitor(visit, *node);
+			if (next == Visit::stop) {
+				return node;
+			}
+			if (next == Visit::proceed) {
+				// Last child first, so the first comes off the stack first
+				for (auto child = node->subNodes.rbegin(); child != node->subNodes.rend(); ++child) {
+					pending.push(&*child);
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Visit a tree breadth first, one level at a time, without a queue.
+	 * Like preorder(), but only allocates once a level is wider than 32 nodes.
+	 *
+	 * @return The node the visitor stopped at, or nullptr if it visited everything.
+	 */
+	template <typename Visitor>
+	const OrderNode* levelorder(const OrderNode& root, Visitor&& visit) {
+		SmallStack<const OrderNode*> level;
+		SmallStack<const OrderNode*> nextLevel;
+		level.push(&root);
+		while (!level.empty()) {
+			for (std::size_t i = 0; i < level.size(); i++) {
+				const OrderNode* node = level[i];
+				Visit next = detail::invokeVisitor(visit, *node);
+				if (next == Visit::stop) {
+					return node;
+				}
+				if (next == Visit::proceed) {
+					for (const OrderNode& child : node->subNodes) {
+						nextLevel.push(&child);
+					}
+				}
+			}
+			std::swap(level, nextLevel);
+			nextLevel.clear();
+		}
+		return nullptr;
+	}
+
+
+	/**
+	 * @brief Find a node depth first, calling f on every node on the way, the found one included.
+	 */
+	template <typename Visitor>
+	std::optional<std::reference_wrapper<const OrderNode>> dfs(const OrderNode& node, std::string_view id, Visitor&& f) {
+		const OrderNode* found = preorder(node, [&](const OrderNode& n) {
+			std::invoke(f, n);
+			return n.id == id ? Visit::stop : Visit::proceed;
+		});
+		return found ? std::optional{std::cref(*found)} : std::nullopt;
+	}
+
+	inline std::optional<std::reference_wrapper<const OrderNode>> dfs(const OrderNode& node, std::string_view id) {
+		return dfs(node, id, [](const OrderNode&) {});
+	}
+
+	/**
+	 * @brief Find a node breadth first, calling f on every node on the way, the found one included.
+	 */
+	template <typename Visitor>
+	std::optional<std::reference_wrapper<const OrderNode>> bfs(const OrderNode& node, std::string_view id, Visitor&& f) {
+		const OrderNode* found = levelorder(node, [&](const OrderNode& n) {
+			std::invoke(f, n);
+			return n.id == id ? Visit::stop : Visit::proceed;
+		});
+		return found ? std::optional{std::cref(*found)} : std::nullopt;
+	}
+
+	inline std::optional<std::reference_wrapper<const OrderNode>> bfs(const OrderNode& node, std::string_view id) {
+		return bfs(node, id, [](const OrderNode&) {});
+	}
+
 	
 	std::string prettifyTree(OrderNode& root);
 
@@ -61,7 +236,202 @@ namespace trees {
 
 		}
 	}
+	/**
+	 * @brief Build a tree from a map of each node's id to its parent's, in time linear in the number of nodes.
+	 * Children are grouped under their parents with a counting sort, and the tree is built in one pass from the root.
+	 * The root needn't be in the map. Siblings come in the map's iteration order.
+	 * Throws std::invalid_argument if a node's parent is neither in the map nor the root,
+	 * or if some nodes never lead back to the root because their parents form a cycle.
+	 */
 	OrderNode buildTree(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId);
+
+
+	/**
+	 * @brief A tree laid out as one array in pre-order, which is also draw order.
+	 * Every node's subtree is the run of nodes from it up to its subtreeEnd, so skipping a subtree is a jump,
+	 * and walking the whole tree is a loop over the array, with no stack at all. Ids share one buffer.
+	 * A snapshot: it doesn't change with the tree it was made from.
+	 */
+	class FlatTree {
+		public:
+		static constexpr std::uint32_t none = UINT32_MAX;
+
+		struct Node {
+			public:
+			std::uint32_t idOffset;
+			std::uint32_t idLength;
+			// Index of the parent; none for the root
+			std::uint32_t parent;
+			// One past the last node of this one's subtree
+			std::uint32_t subtreeEnd;
+			std::uint32_t depth;
+		};
+
+		private:
+		std::vector<Node> nodes;
+		std::string ids;
+
+		friend class LayerGraph;
+
+		void append(std::string_view id, std::uint32_t parent);
+
+		// Works out every subtreeEnd, once all nodes are in
+		void closeSubtrees();
+
+		FlatTree() = default;
+
+		public:
+		/**
+		 * @brief Flatten a tree; the root is node 0.
+		 */
+		FlatTree(const OrderNode& root);
+
+		/**
+		 * @brief Build a tree straight from a map of each node's id to its parent's, like buildTree(),
+		 * but without a node object or string per node; the way to go for very large trees.
+		 */
+		FlatTree(const std::unordered_map<std::string_view, std::string_view>& m, std::string_view rootId);
+
+		std::size_t size() const {
+			return nodes.size();
+		}
+
+		const Node& operator[](std::uint32_t i) const {
+			return nodes[i];
+		}
+
+		std::string_view id(std::uint32_t i) const {
+			return std::string_view{ids}.substr(nodes[i].idOffset, nodes[i].idLength);
+		}
+
+		/**
+		 * @brief Index of the node with the given id, or none. Linear.
+		 */
+		std::uint32_t find(std::string_view id) const;
+
+		/**
+		 * @brief Visit the nodes from first up to the end of its subtree, in pre-order, by index.
+		 * The visitor may return a Visit to skip a node's children or stop; nothing is allocated either way.
+		 *
+		 * @return The index the visitor stopped at, or none if it visited everything.
+		 */
+		template <typename Visitor>
+		std::uint32_t visit(Visitor&& visitor, std::uint32_t first = 0) const {
+			if (first >= nodes.size()) {
+				return none;
+			}
+			std::uint32_t end = nodes[first].subtreeEnd;
+			for (std::uint32_t i = first; i < end; ) {
+				Visit next = detail::invokeVisitor(visitor, i);
+				if (next == Visit::stop) {
+					return i;
+				}
+				i = next == Visit::skipChildren ? nodes[i].subtreeEnd : i + 1;
+			}
+			return none;
+		}
+
+		/**
+		 * @brief Visit a node's children, in order, by index.
+		 */
+		template <typename Visitor>
+		void forEachChild(std::uint32_t parent, Visitor&& visitor) const {
+			for (std::uint32_t child = parent + 1; child < nodes[parent].subtreeEnd; child = nodes[child].subtreeEnd) {
+				std::invoke(visitor, child);
+			}
+		}
+	};
+
+
+	/**
+	 * @brief Layers arranged in a tree, kept in draw order as they're added and removed.
+	 * Each layer is drawn over its parent, and later siblings (and everything on them) over earlier ones;
+	 * that's a pre-order walk of the tree, which is kept as a linked list so that nothing has to be rebuilt.
+	 * Every node knows the last node of its subtree, so a new layer goes straight in after its parent's subtree,
+	 * and adding or removing one only has to fix up its ancestors: O(depth) rather than a rebuild of the whole tree.
+	 */
+	class LayerGraph {
+		private:
+		static constexpr std::uint32_t none = UINT32_MAX;
+
+		struct Node {
+			public:
+			// Points at the key in index, which stays put
+			const std::string* id;
+			std::uint32_t parent;
+			// Neighbours in draw order
+			std::uint32_t prev;
+			std::uint32_t next;
+			// Last node of this one's subtree in draw order; itself if it has no children
+			std::uint32_t last;
+		};
+
+		std::vector<Node> nodes;
+		std::vector<std::uint32_t> freeSlots;
+		std::unordered_map<std::string, std::uint32_t, TransparentStringHash, std::equal_to<>> index;
+		std::uint32_t root;
+
+		// Draw order flattened for iteration; brought up to date on demand, so a batch of changes costs one walk
+		std::vector<std::string_view> order;
+		bool orderValid = true;
+
+		std::uint32_t link(std::string_view id, std::uint32_t parent);
+
+		public:
+		/**
+		 * @brief Construct a LayerGraph with only a root. The root isn't a layer itself, and isn't part of the draw order.
+		 */
+		LayerGraph(std::string_view rootId);
+
+		// Nodes and the draw order point at the keys in index, so a copy would point back into the original
+		LayerGraph(const LayerGraph&) = delete;
+		LayerGraph& operator=(const LayerGraph&) = delete;
+
+		LayerGraph(LayerGraph&&) = default;
+		LayerGraph& operator=(LayerGraph&&) = default;
+
+		/**
+		 * @brief Add a layer on top of its parent and all of the parent's existing children.
+		 * Throws std::invalid_argument if the id is taken or the parent doesn't exist, leaving the graph as it was.
+		 */
+		void add(std::string_view id, std::string_view parentId);
+
+		/**
+		 * @brief Add many layers at once, as (id, parent id) pairs, in any order; a parent may come after its children.
+		 * Siblings are stacked in the order they're given. Linear in the size of the batch.
+		 * Throws std::invalid_argument if an id is taken, or a layer's parent is neither in the graph nor the batch
+		 * (which includes layers that are each other's ancestors); nothing is added in that case.
+		 */
+		void add(std::span<const std::pair<std::string_view, std::string_view>> layers);
+
+		/**
+		 * @brief Remove a layer along with everything on it.
+		 *
+		 * @param onRemoved Called with the id of each removed layer, the layer itself first, while the id is still valid.
+		 */
+		void remove(std::string_view id, const std::function<void(std::string_view)>& onRemoved = {});
+
+		bool contains(std::string_view id) const {
+			return index.find(id) != index.end();
+		}
+
+		// Number of layers, not counting the root
+		std::size_t size() const {
+			return index.size() - 1;
+		}
+
+		std::string_view parentOf(std::string_view id) const;
+
+		/**
+		 * @brief Every layer, bottom first.
+		 */
+		const std::vector<std::string_view>& drawOrder();
+
+		/**
+		 * @brief Snapshot the graph as a FlatTree, the root at index 0 and the layers after it in draw order.
+		 */
+		FlatTree flatten() const;
+	};
 	
 }
 
@@ -1,8 +1,12 @@
 #ifndef VNPGE_UTILITY_HEADER
 #define VNPGE_UTILITY_HEADER
 #include <concepts>
+#include <cstddef>
+#include <functional>
 #include <iterator>
 #include <ranges>
+#include <string>
+#include <string_view>
 
 template <std::ranges::bidirectional_range C>
 struct reverse_wrapper {
@@ -21,4 +25,14 @@ reverse_wrapper<C> r_wrap(C& c) {
 }
 
 
+// Lets string-keyed unordered containers be searched with a string_view, without building a std::string for every lookup
+struct TransparentStringHash {
+    using is_transparent = void;
+
+    std::size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>{}(s);
+    }
+};
+
+
 #endif
\ No newline at end of file
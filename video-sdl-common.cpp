@@ -5,8 +5,12 @@
 
 #include <SDL2/SDL_events.h>
 #include <SDL2/SDL_keycode.h>
+#include <SDL2/SDL_rwops.h>
+#include <SDL2/SDL_ttf.h>
 
 #include "schedule.h"
+#include "font-cache.h"
+#include "video-sdl-common.h"
 
 namespace vnpge {
 
@@ -60,68 +64,98 @@ SDL_Surface* makeNewSurface(uint w, uint h) {
 	return surf;
 };
 
-Schedule<Event> handleEvents() {
-	std::vector<Event> events;
+/**
+ * @brief Turn a raw SDL event into the Event it stands for, if any, and append it to events.
+ */
+void translateEvent(const SDL_Event& event, std::vector<Event>& events) {
+	Action action = Action::nothing;
+	int data1 = 255;
+	int data2 = 255;
+
+	switch (event.type) {
+		case SDL_KEYDOWN: {
+			// Held keys would otherwise flip through pages at the key repeat rate
+			if (event.key.repeat) {
+				break;
+			}
+			switch(event.key.keysym.sym) {
+				case SDLK_ESCAPE: {
+					// 137; magic number for program exit
+					action = Action::clean_exit;
+				}
+				break;
+				case SDLK_RIGHT:
+				case SDLK_c:
+				case SDLK_SPACE: {
+					action = Action::next_page;
+				}
+				break;
+				case SDLK_LEFT:
+				case SDLK_z: {
+					action = Action::prev_page;
+				}
+				break;
 
-	SDL_Event event;
-	while (SDL_PollEvent(&event)) {
-		switch (event.type) {
-			case SDL_KEYDOWN: {
-				switch(event.key.keysym.sym) {
-					case SDLK_ESCAPE: {
-						// 137; magic number for program exit
-						events.emplace_back(Action::clean_exit);
-					}
-					break;
-					case SDLK_RIGHT:
-					case SDLK_c:
-					case SDLK_SPACE: {
-						if (!event.key.repeat) {
-							events.emplace_back(Action::next_page);
-						}
-					}
-					break;
-					case SDLK_LEFT:
-					case SDLK_z: {
-						if (!event.key.repeat) {
-							events.emplace_back(Action::prev_page);
-						}
-					}
-					break;
-
-					case SDLK_UP:{
-						if (!event.key.repeat) {
-							events.emplace_back(Action::scroll_up);
-						}
-					}
-					break;
-					case SDLK_DOWN:{
-						if (!event.key.repeat) {
-							events.emplace_back(Action::scroll_down);
-						}
-					}
-					break;
+				case SDLK_UP:{
+					action = Action::scroll_up;
+				}
+				break;
+				case SDLK_DOWN:{
+					action = Action::scroll_down;
 				}
+				break;
 			}
-			break;
-			case SDL_WINDOWEVENT: {
-				switch(event.window.event) {
-					case SDL_WINDOWEVENT_RESIZED: {
-						events.emplace_back(Action::window_resized, event.window.data1, event.window.data2);
-					}
-					break;
-					case SDL_WINDOWEVENT_CLOSE: {
-						events.emplace_back(Action::clean_exit);
-					}
+		}
+		break;
+		case SDL_WINDOWEVENT: {
+			switch(event.window.event) {
+				case SDL_WINDOWEVENT_RESIZED: {
+					action = Action::window_resized;
+					data1 = event.window.data1;
+					data2 = event.window.data2;
+				}
+				break;
+				case SDL_WINDOWEVENT_CLOSE: {
+					action = Action::clean_exit;
 				}
 			}
-			break;
 		}
+		break;
+	}
+
+	if (action != Action::nothing) {
+		events.emplace_back(action, data1, data2, event.common.timestamp);
+	}
+};
+
+Schedule<Event> handleEvents() {
+	std::vector<Event> events;
+
+	SDL_Event event;
+	while (SDL_PollEvent(&event)) {
+		translateEvent(event, events);
 	}
 	Schedule<Event> evSched = {events};
 	return evSched;
 };
 
+void waitEvents(std::vector<Event>& events, int timeoutMs) {
+	events.clear();
+
+	SDL_Event event;
+	// Sleep until something happens. SDL_WaitEventTimeout returns 0 for both timeouts and errors, and either way there's nothing to do
+	int got = (timeoutMs < 0) ? SDL_WaitEvent(&event) : SDL_WaitEventTimeout(&event, timeoutMs);
+	if (!got) {
+		return;
+	}
+	translateEvent(event, events);
+
+	// Then drain whatever else has queued up, so it's all handled in one go
+	while (SDL_PollEvent(&event)) {
+		translateEvent(event, events);
+	}
+};
+
 std::string printRect(const SDL_Rect& rect) {
 	return { "x: " + std::to_string(rect.x) + ", y: " + std::to_string(rect.y) +
 		", w: " + std::to_string(rect.w) + ", h: " + std::to_string(rect.h) };
@@ -130,5 +164,56 @@ std::string printRect(const SDL_Rect& rect) {
 std::string printAbsDims(const AbsoluteDimensions& dims) {
 	return { "w: " + std::to_string(dims.w) + ", h : " + std::to_string(dims.h) };
 };
+
+namespace {
+	// Open a font from its mapped file. The font reads from the mapping for as long as it's open, so it keeps the mapping alive
+	std::shared_ptr<TTF_Font> openMappedFont(const std::shared_ptr<const MappedFile>& file, const FontKey& key) {
+		SDL_RWops* rw = SDL_RWFromConstMem(file->data(), static_cast<int>(file->size()));
+		if (rw == nullptr) {
+			std::string err = "Font could not be loaded. SDL_Error: ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+
+		TTF_Font* font = TTF_OpenFontDPIRW(rw, 1, static_cast<int>(key.ptSize), static_cast<unsigned int>(key.hdpi), static_cast<unsigned int>(key.vdpi));
+		if (font == nullptr) {
+			std::string err = "Font could not be loaded. TTF_Error:";
+			throw std::runtime_error(err.append(TTF_GetError()));
+		}
+		return {font, [file](TTF_Font* f) { TTF_CloseFont(f); }};
+	}
+
+	FontKey displayFontKey(const std::string& path, uint ptSize) {
+		float hdpi, vdpi;
+		SDL_GetDisplayDPI(0, nullptr, &hdpi, &vdpi);
+		return {.path = path, .ptSize = ptSize, .hdpi = hdpi, .vdpi = vdpi};
+	}
+}
+
+SDLFont openFont(const std::string& path, uint ptSize) {
+	FontKey key = displayFontKey(path, ptSize);
+	auto font = FontCache<TTF_Font>::global().get(key, [&](const std::shared_ptr<const MappedFile>& file) { return openMappedFont(file, key); });
+	return {std::move(font), ptSize};
 }
 
+SDLFont openUnsharedFont(const std::string& path, uint ptSize) {
+	return {openMappedFont(mapFontFile(path), displayFontKey(path, ptSize)), ptSize};
+}
+
+AdvanceTable::AdvanceFunc measureAdvances(SDLFont font) {
+	return [font](char32_t cp) {
+		int advance = 0;
+		if (!TTF_GlyphIsProvided32(font.getFont(), cp)) {
+			cp = U'�';
+		}
+		TTF_GlyphMetrics32(font.getFont(), cp, nullptr, nullptr, nullptr, nullptr, &advance);
+		return static_cast<float>(advance);
+	};
+}
+
+AdvanceTable::KerningFunc measureKerning(SDLFont font) {
+	return [font](char32_t previous, char32_t cp) {
+		return static_cast<float>(TTF_GetFontKerningSizeGlyphs32(font.getFont(), previous, cp));
+	};
+}
+
+}
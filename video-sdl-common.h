@@ -1,17 +1,184 @@
 #ifndef VN_VIDEO_SDL_COMMON
 #define VN_VIDEO_SDL_COMMON
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+
 #include <SDL2/SDL_video.h>
+#include <SDL2/SDL_events.h>
+#include <SDL2/SDL_timer.h>
+#include <SDL2/SDL_ttf.h>
 
 #include "structures.h"
 #include "schedule.h"
+#include "text-layout.h"
 
 namespace vnpge {
 	SDL_Surface* makeNewSurface(uint w, uint h);
 	
+	void translateEvent(const SDL_Event& event, std::vector<Event>& events);
 	Schedule<Event> handleEvents();
+
+	/**
+	 * @brief Sleep until input arrives or the timeout runs out, then collect every pending event.
+	 * 
+	 * @param events Buffer to fill; cleared first, and reused between calls so its storage is too.
+	 * @param timeoutMs How long to wait for, or -1 to wait indefinitely.
+	 */
+	void waitEvents(std::vector<Event>& events, int timeoutMs);
+
 	AbsolutePosition getPixelPosfromPosition(AbsoluteDimensions& srcDim, AbsoluteDimensions& destDim, PositionMapping& posMap);
 	
-	std::string printRect(SDL_Rect& rect);
+	std::string printRect(const SDL_Rect& rect);
 	std::string printAbsDims(const AbsoluteDimensions& dims);
+
+
+	/**
+	 * @brief Handle to an SDL_ttf font at one size. Copies share the font, which stays open as long as any of them do.
+	 */
+	class SDLFont {
+		private:
+		std::shared_ptr<TTF_Font> font;
+		uint ptSize = 0;
+
+		public:
+		SDLFont() = default;
+		SDLFont(std::shared_ptr<TTF_Font> font, uint ptSize) : font{std::move(font)}, ptSize{ptSize} {};
+
+		TTF_Font* getFont() const {
+			return font.get();
+		}
+
+		uint getPtSize() const {
+			return ptSize;
+		}
+	};
+
+	/**
+	 * @brief Open a font at the main display's DPI, through the process-wide FontCache.
+	 * Opening the same font at the same size again is just a lookup, and every size shares one mapping of the file.
+	 */
+	SDLFont openFont(const std::string& path, uint ptSize);
+
+	/**
+	 * @brief Open a font that isn't shared through the cache, for use on another thread; a TTF_Font can only be used by one at a time.
+	 * It still reads from the shared mapping of the file.
+	 */
+	SDLFont openUnsharedFont(const std::string& path, uint ptSize);
+
+	/**
+	 * @brief Measuring functions for an AdvanceTable, going straight to a font.
+	 * Code points the font has no glyph for are measured as the replacement character, which is what the GPU backend draws for them,
+	 * so both SDL backends lay the same text out the same way.
+	 */
+	AdvanceTable::AdvanceFunc measureAdvances(SDLFont font);
+
+	AdvanceTable::KerningFunc measureKerning(SDLFont font);
+
+
+	/**
+	 * @brief Actions due at a later time, like automatic page advancing or animation steps.
+	 * Lets an event-driven loop know how long it may sleep for.
+	 */
+	class TimerQueue {
+		private:
+		struct Timer {
+			public:
+			std::uint32_t deadline;
+			Action action;
+		};
+
+		std::vector<Timer> timers;
+
+		public:
+		/**
+		 * @brief Have an action happen after a delay.
+		 */
+		void schedule(Action action, std::uint32_t delayMs) {
+			timers.push_back({SDL_GetTicks() + delayMs, action});
+		}
+
+		/**
+		 * @brief Drop all pending timers for an action.
+		 */
+		void cancel(Action action) {
+			std::erase_if(timers, [action](const Timer& t) { return t.action == action; });
+		}
+
+		/**
+		 * @brief How long until the next timer is due, in the form waitEvents() takes: -1 if there are none.
+		 */
+		int timeUntilNext() const {
+			if (timers.empty()) {
+				return -1;
+			}
+			std::uint32_t now = SDL_GetTicks();
+			auto next = std::min_element(timers.begin(), timers.end(), [](const Timer& a, const Timer& b) {
+				return static_cast<std::int32_t>(a.deadline - b.deadline) < 0;
+			});
+			if (SDL_TICKS_PASSED(now, next->deadline)) {
+				return 0;
+			}
+			return static_cast<int>(next->deadline - now);
+		}
+
+		/**
+		 * @brief Append an Event for every timer that's due, and remove those timers.
+		 */
+		void fire(std::vector<Event>& events) {
+			std::uint32_t now = SDL_GetTicks();
+			std::erase_if(timers, [&](const Timer& t) {
+				if (!SDL_TICKS_PASSED(now, t.deadline)) {
+					return false;
+				}
+				events.emplace_back(t.action, 255, 255, t.deadline);
+				return true;
+			});
+		}
+	};
+
+	/**
+	 * @brief Running statistics of the time from input to the frame showing its result being presented.
+	 * Resolution is that of SDL's event timestamps, i.e. milliseconds.
+	 */
+	class LatencyStats {
+		private:
+		std::uint64_t samples = 0;
+		std::uint64_t total = 0;
+		std::uint32_t worst = 0;
+		std::uint32_t latest = 0;
+
+		public:
+		/**
+		 * @brief Record a present that answered input received at inputTimestamp. Call right after presenting.
+		 */
+		void record(std::uint32_t inputTimestamp) {
+			if (inputTimestamp == 0) {
+				return;
+			}
+			latest = SDL_GetTicks() - inputTimestamp;
+			worst = std::max(worst, latest);
+			total += latest;
+			samples++;
+		}
+
+		std::uint64_t count() const {
+			return samples;
+		}
+
+		double mean() const {
+			return samples ? static_cast<double>(total) / static_cast<double>(samples) : 0.0;
+		}
+
+		std::uint32_t max() const {
+			return worst;
+		}
+
+		std::uint32_t last() const {
+			return latest;
+		}
+	};
 }
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,17 @@
 module;
 #include <SDL2/SDL_render.h>
+#include <algorithm>
+#include <cmath>
 #include <limits>
 #include <memory>
 #include <stdexcept>
 #include <functional>
+#include <list>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_surface.h>
@@ -18,6 +26,9 @@ module;
 #include "video-sdl-common.h"
 
 #include "structures.h"
+#include "font-cache.h"
+#include "text-layout.h"
+#include "chapter-layout.h"
 
 
 export module AcceleratedText;
@@ -27,30 +38,6 @@ import StoryDialogue;
 
 export namespace vnpge {
 
-	class GPUFont : DialogueFont {
-	private:
-	std::shared_ptr<TTF_Font> font;
-
-	public:
-	GPUFont(DialogueFont& dfont, uint ptSize) : DialogueFont(dfont) {
-		float hdpi, vdpi;
-		SDL_GetDisplayDPI(0, nullptr, &hdpi, &vdpi);
-		font = {TTF_OpenFontDPI(dfont.getName().c_str(), ptSize, hdpi, vdpi), TTF_CloseFont };
-
-		if (font == nullptr) {
-			std::string err = "Font could not be loaded. TTF_Error:";
-			throw std::runtime_error(err.append(TTF_GetError()));
-		}
-	};
-
-	GPUFont() = default;
-	TTF_Font* getFont() {
-		return font.get();
-	}
-
-	~GPUFont() {};
-	};
-
 class TextBoxInfo {
 	private:
 	AbsoluteDimensions resolution;
@@ -69,57 +56,307 @@ class TextBoxInfo {
 };
 
 
-class FontStorage {
+/**
+ * @brief Texture pages holding every glyph of one font, at one size, that has been drawn so far.
+ * Glyphs are rasterised the first time they're asked for, in white so that vertex colours can tint them,
+ * and packed into rows ("shelves") on the current page. When a page fills up, another one is started.
+ */
+class GlyphAtlas {
+	public:
+	struct Glyph {
+		public:
+		uint page;
+		// Where in the page; empty for glyphs with nothing to draw
+		SDL_Rect rect;
+		int advance;
+	};
+
+	static constexpr int pageSize = 1024;
+
 	private:
-	std::unordered_map<std::string, vnpge::GPUFont> fontMap;
-	static uint getPtSize(const AbsoluteDimensions& boxDims) {
-		double boxHeight = static_cast<double>(boxDims.h) * 0.25;
-		uint ptSize;
-		uint numLines = 5;
-
-		// TODO: Evaluate pixel values based on DPI
-
-		while (boxHeight > 20) {
-			ptSize = boxHeight / numLines;
-			std::cout << "ptSize: " << ptSize << std::endl;
-			if (ptSize > 30) {
-				numLines += 1;
-				continue;
-			}
-			if (ptSize < 10) {
-				numLines -= 1;
-				continue;
-			}
+	// Keeps glyphs from bleeding into each other when sampled with filtering
+	static constexpr int padding = 1;
+
+	SDL_Renderer* renderer;
+	SDLFont font;
+
+	std::vector<std::shared_ptr<SDL_Texture>> pages;
+	std::unordered_map<char32_t, Glyph> glyphs;
+
+	// Measurements for the shared line breaker. These go straight to the font rather than through the atlas,
+	// so laying text out never has to rasterise anything
+	AdvanceTable advances;
+
+	int shelfX = 0;
+	int shelfY = 0;
+	int shelfHeight = 0;
+
+	void newPage() {
+		std::shared_ptr<SDL_Texture> page = {SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, pageSize, pageSize), SDL_DestroyTexture};
+		if (page == nullptr) {
+			std::string err = "Glyph atlas page could not be created! SDL_Error: ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+		SDL_SetTextureBlendMode(page.get(), SDL_BLENDMODE_BLEND);
+
+		// Static textures start out undefined; clear it once, so the padding really is transparent
+		std::vector<Uint32> blank(pageSize * pageSize, 0);
+		SDL_UpdateTexture(page.get(), nullptr, blank.data(), pageSize * sizeof(Uint32));
+
+		pages.push_back(std::move(page));
+		shelfX = 0;
+		shelfY = 0;
+		shelfHeight = 0;
+	}
+
+	// Find room for a w by h glyph, starting a new shelf or page as needed
+	SDL_Rect allocate(int w, int h) {
+		if (w + padding > pageSize || h + padding > pageSize) {
+			throw std::runtime_error("Glyph is too large for the glyph atlas; is the font size sensible?");
+		}
+		if (shelfX + w + padding > pageSize) {
+			shelfY += shelfHeight;
+			shelfX = 0;
+			shelfHeight = 0;
+		}
+		if (pages.empty() || shelfY + h + padding > pageSize) {
+			newPage();
+		}
+
+		SDL_Rect rect = {.x = shelfX, .y = shelfY, .w = w, .h = h};
+		shelfX += w + padding;
+		shelfHeight = std::max(shelfHeight, h + padding);
+		return rect;
+	}
+
+	public:
+	GlyphAtlas(SDL_Renderer* renderer, SDLFont font) : renderer{renderer}, font{font},
+		advances{measureAdvances(font), measureKerning(font), static_cast<float>(TTF_FontLineSkip(font.getFont()))} {};
+
+	// Glyphs and layouts point into the atlas, so it stays put
+	GlyphAtlas(const GlyphAtlas&) = delete;
+
+	AdvanceTable& getAdvances() {
+		return advances;
+	}
+
+	/**
+	 * @brief Get a glyph, rasterising it into the atlas if this is its first use.
+	 * References stay valid for the lifetime of the atlas.
+	 */
+	const Glyph& get(char32_t cp) {
+		if (auto it = glyphs.find(cp); it != glyphs.end()) {
+			return it->second;
+		}
+
+		TTF_Font* ttf = font.getFont();
+		if (!TTF_GlyphIsProvided32(ttf, cp) && cp != U'�') {
+			// Draw the replacement character instead, but remember it under this code point so the lookup is cached too
+			Glyph replacement = get(U'�');
+			return glyphs.emplace(cp, replacement).first->second;
+		}
+
+		int minx, maxx, miny, maxy, advance;
+		TTF_GlyphMetrics32(ttf, cp, &minx, &maxx, &miny, &maxy, &advance);
+
+		Glyph glyph = {.page = 0, .rect = {0, 0, 0, 0}, .advance = advance};
 
-			if (boxHeight / (numLines + 1) < 25) {
-				std::cout << "boxheight: " << boxHeight << ", numLines: " << numLines << std::endl;
-				break;
+		SDL_Surface* rendered = TTF_RenderGlyph32_Blended(ttf, cp, {255, 255, 255, 255});
+		if (rendered != nullptr && rendered->w > 0 && rendered->h > 0) {
+			SDL_Surface* surf = rendered;
+			if (surf->format->format != SDL_PIXELFORMAT_ARGB8888) {
+				surf = SDL_ConvertSurfaceFormat(rendered, SDL_PIXELFORMAT_ARGB8888, 0);
+				SDL_FreeSurface(rendered);
 			}
-			else {
-				numLines += 1;
+			if (surf == nullptr) {
+				std::string err = "Glyph could not be converted! SDL_Error: ";
+				throw std::runtime_error(err.append(SDL_GetError()));
 			}
+
+			glyph.rect = allocate(surf->w, surf->h);
+			glyph.page = static_cast<uint>(pages.size() - 1);
+			SDL_UpdateTexture(pages.back().get(), &glyph.rect, surf->pixels, surf->pitch);
+			SDL_FreeSurface(surf);
+		}
+		else if (rendered != nullptr) {
+			SDL_FreeSurface(rendered);
 		}
-		numLines += static_cast<uint>(boxDims.h / boxDims.w);
 
+		return glyphs.emplace(cp, glyph).first->second;
+	}
+
+	int lineSkip() {
+		return TTF_FontLineSkip(font.getFont());
+	}
 
-		return static_cast<uint>(std::round(static_cast<double>(boxHeight) / static_cast<double>(numLines))) * 3;
+	SDL_Texture* getPage(uint page) {
+		return pages[page].get();
 	}
+};
+
+
+/**
+ * @brief Dialogue laid out as textured quads over a GlyphAtlas, ready for SDL_RenderGeometry.
+ * Positions are relative to the top left of the text.
+ */
+struct TextLayout {
 	public:
-	GPUFont operator() (DialogueFont font, const AbsoluteDimensions& boxDims ) {
-		if (!fontMap.contains(font.getName())) {
-			fontMap.insert({font.getName(), {font, getPtSize(boxDims)}});
+	struct Batch {
+		public:
+		uint page;
+		std::vector<SDL_Vertex> vertices;
+		std::vector<int> indices;
+	};
+
+	// Atlas the batches' pages belong to
+	GlyphAtlas* atlas = nullptr;
+	// One per atlas page used, so normally just the one
+	std::vector<Batch> batches;
+	// Byte offset into the text at which each line starts, the first one included
+	std::vector<std::uint32_t> lineStarts;
+	int height = 0;
+	int lineHeight = 0;
+};
+
+/**
+ * @brief Lay text out with the shared line breaker, then turn it into quads over the atlas.
+ *
+ * @param lineStarts Where the lines start, if they've been worked out already; otherwise the text is wrapped to wrapWidth.
+ */
+TextLayout layoutText(GlyphAtlas& atlas, std::string_view text, SDL_Color colour, int wrapWidth, std::span<const std::uint32_t> lineStarts = {}) {
+	ParagraphLayout paragraph = lineStarts.empty() ? layoutParagraph(text, atlas.getAdvances(), static_cast<float>(wrapWidth))
+	                                               : placeLines(text, atlas.getAdvances(), lineStarts);
+
+	TextLayout layout;
+	layout.atlas = &atlas;
+	layout.lineHeight = atlas.lineSkip();
+	layout.lineStarts = std::move(paragraph.lineStarts);
+	layout.height = static_cast<int>(layout.lineStarts.size()) * layout.lineHeight;
+
+	float texel = 1.0f / GlyphAtlas::pageSize;
+	for (const PlacedCluster& cluster : paragraph.clusters) {
+		// Code points within a cluster (combining marks and such) are drawn one after another from the cluster's position
+		float penX = cluster.x;
+		for (std::size_t pos = cluster.offset; pos < cluster.offset + cluster.length;) {
+			char32_t cp = decodeUTF8(text, pos);
+			if (cp < 0x20) {
+				continue;
+			}
+			const GlyphAtlas::Glyph& glyph = atlas.get(cp);
+			const SDL_Rect& r = glyph.rect;
+
+			if (r.w > 0) {
+				auto batch = std::find_if(layout.batches.begin(), layout.batches.end(), [&](const TextLayout::Batch& b) { return b.page == glyph.page; });
+				if (batch == layout.batches.end()) {
+					layout.batches.push_back({.page = glyph.page, .vertices = {}, .indices = {}});
+					batch = std::prev(layout.batches.end());
+				}
+
+				float x0 = std::round(penX);
+				float y0 = static_cast<float>(cluster.line * layout.lineHeight);
+				float x1 = x0 + r.w;
+				float y1 = y0 + r.h;
+				float u0 = r.x * texel;
+				float v0 = r.y * texel;
+				float u1 = (r.x + r.w) * texel;
+				float v1 = (r.y + r.h) * texel;
+
+				int base = static_cast<int>(batch->vertices.size());
+				batch->vertices.push_back({{x0, y0}, colour, {u0, v0}});
+				batch->vertices.push_back({{x1, y0}, colour, {u1, v0}});
+				batch->vertices.push_back({{x1, y1}, colour, {u1, v1}});
+				batch->vertices.push_back({{x0, y1}, colour, {u0, v1}});
+				for (int i : {0, 1, 2, 0, 2, 3}) {
+					batch->indices.push_back(base + i);
+				}
+			}
+			penX += glyph.advance;
 		}
-		return fontMap.at(font.getName());
 	}
 
-	void clear() {
-		fontMap.clear();
+	return layout;
+}
+
+
+/**
+ * @brief Everything that goes into laying out a piece of dialogue.
+ */
+struct TextLayoutKey {
+	public:
+	std::string text;
+	std::string font;
+	uint ptSize;
+	int wrapWidth;
+	// As 0xRRGGBBAA
+	Uint32 colour;
+
+	bool operator==(const TextLayoutKey&) const = default;
+};
+
+struct TextLayoutKeyHash {
+	public:
+	std::size_t operator()(const TextLayoutKey& key) const {
+		std::size_t h = std::hash<std::string>{}(key.text);
+		for (std::size_t part : {std::hash<std::string>{}(key.font), std::size_t{key.ptSize}, static_cast<std::size_t>(key.wrapWidth), std::size_t{key.colour}}) {
+			h ^= part + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+		}
+		return h;
 	}
 };
 
+/**
+ * @brief Small LRU cache of finished layouts, so paging back and forth between frames doesn't lay the same dialogue out again.
+ * Layouts point into glyph atlases, so this has to be cleared whenever they are.
+ */
+class TextLayoutCache {
+	private:
+	using Entry = std::pair<TextLayoutKey, std::shared_ptr<const TextLayout>>;
+
+	// Most recently used at the front
+	std::list<Entry> entries;
+	std::unordered_map<TextLayoutKey, std::list<Entry>::iterator, TextLayoutKeyHash> index;
+	std::size_t capacity;
+
+	std::size_t hits = 0;
+	std::size_t misses = 0;
+
+	public:
+	TextLayoutCache(std::size_t capacity = 16) : capacity{capacity} {};
+
+	/**
+	 * @brief Get the layout for a key, calling makeLayout to produce it on a miss.
+	 */
+	std::shared_ptr<const TextLayout> get(const TextLayoutKey& key, const std::function<TextLayout()>& makeLayout) {
+		if (auto it = index.find(key); it != index.end()) {
+			hits++;
+			entries.splice(entries.begin(), entries, it->second);
+			return it->second->second;
+		}
+
+		misses++;
+		entries.emplace_front(key, std::make_shared<const TextLayout>(makeLayout()));
+		index.emplace(key, entries.begin());
+
+		if (entries.size() > capacity) {
+			index.erase(entries.back().first);
+			entries.pop_back();
+		}
+		return entries.front().second;
+	}
 
+	void clear() {
+		index.clear();
+		entries.clear();
+	}
 
+	std::size_t getHits() const {
+		return hits;
+	}
 
+	std::size_t getMisses() const {
+		return misses;
+	}
+};
 
 
 /**
@@ -134,17 +371,28 @@ class TextRenderer {
 	
 
 	std::shared_ptr<SDL_Texture> background;
-	std::shared_ptr<SDL_Texture> text;
+
+	// The current dialogue, as quads over the glyph atlas of its font
+	std::shared_ptr<const TextLayout> text = std::make_shared<const TextLayout>();
+	TextLayoutCache layoutCache;
+	// Where text's vertices are moved into place for drawing; kept around so drawing doesn't allocate
+	std::vector<SDL_Vertex> placedVertices;
 
 	int scrolledLines = 0;
 	int lineHeight;
 
-	FontStorage fontStorage;
+	// One per font; sizes only change along with the resolution, which clears them
+	std::unordered_map<std::string, GlyphAtlas> atlases;
 
 	// Generated values, don't touch
 
 	AbsoluteDimensions textArea;
 	AbsolutePosition textPosition; // origin is at upper left of background
+
+	// Fonts come from the process-wide cache, sized to fit the text box, so this is a lookup unless the size is new
+	SDLFont getFont(DialogueFont font) {
+		return openFont(font.getName(), dialoguePtSize(textArea));
+	}
 	
 	public:
 	TextRenderer(SDL_Renderer* dest, TextBoxInfo boxInfo, TextBGCreator<SDL_Surface*> bgCreator,
@@ -153,7 +401,13 @@ class TextRenderer {
 		renderStoryFrame(dialogue, font);
 	};
 	
-	SDL_Texture* renderStoryFrame(Dialogue dialogue, DialogueFont font) {
+	/**
+	 * @brief Lay out new dialogue. Glyphs not yet in the font's atlas are rasterised into it; nothing else touches a texture.
+	 *
+	 * @param chapterLayout Line breaks worked out ahead of time, used if they're for this font and size; may be null.
+	 * @param frame Index of the dialogue's frame within chapterLayout.
+	 */
+	void renderStoryFrame(Dialogue dialogue, DialogueFont font, const ChapterLayout* chapterLayout = nullptr, std::size_t frame = 0) {
 
 		// Grab dialogue colour
 		SDL_Color fgcolour = {
@@ -164,23 +418,25 @@ class TextRenderer {
 		};
 
 		// Look up font in font table
-		GPUFont f = fontStorage(font, textArea);
-
-		// Temporary storage for the complete text
-		SDL_Surface* renderedText = TTF_RenderUTF8_Blended_Wrapped(f.getFont(), dialogue.getText().c_str(), fgcolour, textArea.w);
-		
-		// Store the updated text
-		text.reset(SDL_CreateTextureFromSurface(dest, renderedText), SDL_DestroyTexture);
+		SDLFont f = getFont(font);
 
+		GlyphAtlas& atlas = atlases.try_emplace(font.getName(), dest, f).first->second;
 
-		// Free the temporary storage
-		SDL_FreeSurface(renderedText);
-		
+		TextLayoutKey key = {
+			.text = dialogue.getText(),
+			.font = font.getName(),
+			.ptSize = f.getPtSize(),
+			.wrapWidth = static_cast<int>(textArea.w),
+			.colour = Uint32{fgcolour.r} << 24 | Uint32{fgcolour.g} << 16 | Uint32{fgcolour.b} << 8 | Uint32{fgcolour.a}
+		};
+		std::span<const std::uint32_t> lineStarts;
+		if (chapterLayout != nullptr && chapterLayout->matches(getLayoutFontKey(font), getWrapWidth())) {
+			lineStarts = chapterLayout->lineStarts(frame);
+		}
+		text = layoutCache.get(key, [&] { return layoutText(atlas, key.text, fgcolour, key.wrapWidth, lineStarts); });
 
 		// Grab the line height of the text, for scrolling purposes
-		lineHeight = TTF_FontLineSkip(f.getFont());
-
-		return text.get();
+		lineHeight = text->lineHeight;
 	};
 
 	void updateResolution(SDL_Renderer* newDest, TextBoxInfo boxInfo, TextBGCreator<SDL_Surface*> bgCreator) {
@@ -196,10 +452,34 @@ class TextRenderer {
 		
 		SDL_FreeSurface(textBGSurface.first);
 
-		fontStorage.clear();
+		// Fonts are kept, so going back to an earlier size doesn't open the file again.
+		// Atlases are rasterised at one size though, and cached layouts point into them and were wrapped to the old width anyway
+		layoutCache.clear();
+		atlases.clear();
+		text = std::make_shared<const TextLayout>();
 		resetScroll();
 	};
 
+	/**
+	 * @brief Identifies a font at the size dialogue is currently drawn in, for matching a ChapterLayout against.
+	 */
+	std::string getLayoutFontKey(DialogueFont font) {
+		return font.getName() + '@' + std::to_string(dialoguePtSize(textArea));
+	}
+
+	float getWrapWidth() const {
+		return static_cast<float>(textArea.w);
+	}
+
+	/**
+	 * @brief Measurements of a font at the current size, for laying out a chapter off the render thread.
+	 * They go through a font of their own, as a TTF_Font can only be used by one thread at a time.
+	 */
+	std::shared_ptr<AdvanceTable> makeLayoutMetrics(DialogueFont font) {
+		SDLFont f = openUnsharedFont(font.getName(), dialoguePtSize(textArea));
+		return std::make_shared<AdvanceTable>(measureAdvances(f), measureKerning(f), static_cast<float>(TTF_FontLineSkip(f.getFont())));
+	}
+
 	void displayText(AbsolutePosition position) {
 		
 		int w, h;
@@ -217,33 +497,31 @@ class TextRenderer {
 			throw std::runtime_error(SDL_GetError());
 		}
 		
-		// Grab the text dimensions (reuses w and h from above; not neat, but the alternative is even less neat)
-		// TODO: write a wrapper for QueryTexture and GetRendererOutputSize
-		SDL_QueryTexture(text.get(), nullptr, nullptr, &w, &h);
-
-		// Offset box pos by text position within the box
-		destPos = {
+		// The writable part of the box; scrolled-away lines are clipped off
+		SDL_Rect textRect = {
 			.x = position.x + textPosition.x,
 			.y = position.y + textPosition.y,
-			.w = w,
-			.h = static_cast<int>((h > textArea.h) ? textArea.h : h)
-		};
-
-		// Pick a rectangle representing the current scrolled level
-		// x is always 0
-		// y is text scroll
-		// w and h are given by the box generator function as the writable part of the box
-		SDL_Rect srcPos = {
-			.x = 0,
-			.y = scrolledLines * lineHeight,
 			.w = static_cast<int>(textArea.w),
 			.h = static_cast<int>(textArea.h)
 		};
-		
-		
 
-		// Put text on screen (less easy!)
-		SDL_RenderCopy(dest, text.get(), &srcPos, &destPos);
+		// Scrolling just moves the quads up by whole lines
+		float offsetX = static_cast<float>(textRect.x);
+		float offsetY = static_cast<float>(textRect.y - scrolledLines * lineHeight);
+
+		// Put text on screen (less easy!); one draw call per atlas page, so normally just the one
+		SDL_RenderSetClipRect(dest, &textRect);
+		for (const TextLayout::Batch& batch : text->batches) {
+			placedVertices.assign(batch.vertices.begin(), batch.vertices.end());
+			for (SDL_Vertex& v : placedVertices) {
+				v.position.x += offsetX;
+				v.position.y += offsetY;
+			}
+
+			SDL_RenderGeometry(dest, text->atlas->getPage(batch.page), placedVertices.data(), static_cast<int>(placedVertices.size()),
+			                   batch.indices.data(), static_cast<int>(batch.indices.size()));
+		}
+		SDL_RenderSetClipRect(dest, nullptr);
 	};
 
 	/**
@@ -251,8 +529,7 @@ class TextRenderer {
 	 * 
 	 */
 	void scrollTextUp() {
-		int w, h;
-		SDL_QueryTexture(text.get(), nullptr, nullptr, &w, &h);
+		int h = text->height;
 		
 		//	Is there more text than can fit  && is the area scrolled away < the difference between the displayable area and the text area 
 		if (static_cast<int>(textArea.h) < h && scrolledLines * lineHeight < h - textArea.h) {
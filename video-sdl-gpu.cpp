@@ -5,6 +5,9 @@ module;
 #include <string>
 #include <exception>
 #include <unordered_map>
+#include <unordered_set>
+#include <list>
+#include <optional>
 #include <ctime>
 
 #include <SDL2/SDL.h>
@@ -19,6 +22,8 @@ module;
 
 #include "structures.h"
 #include "schedule.h"
+#include "damage.h"
+#include "chapter-layout.h"
 
 
 export module AcceleratedRender;
@@ -27,10 +32,14 @@ import Chapter;
 import Image;
 import StoryDialogue;
 import AcceleratedText;
+import ImagePrefetch;
 
 
 export namespace vnpge {
 
+// Font the dialogue is drawn in; also what chapter layouts have to be measured with
+inline constexpr char dialogueFontPath[] = "assets/fonts/BonaNova-Italic.ttf";
+
 template<typename T>
 void nullDeleter(T* surf) {
 };
@@ -38,6 +47,23 @@ void nullDeleter(T* surf) {
 class GPUImage : Image {
 private:
 	std::shared_ptr<SDL_Texture> texture;
+	std::size_t byteSize = 0;
+	uint width = 0;
+	uint height = 0;
+
+	// Query everything drawing needs once, up front, and settle the blend mode, so drawing doesn't have to ask SDL again
+	void prepare() {
+		Uint32 format;
+		int w, h;
+		if (texture == nullptr || SDL_QueryTexture(texture.get(), &format, nullptr, &w, &h)) {
+			return;
+		}
+		width = w;
+		height = h;
+		// Also what the TextureCache's budget is counted in
+		byteSize = static_cast<std::size_t>(w) * static_cast<std::size_t>(h) * SDL_BYTESPERPIXEL(format);
+		SDL_SetTextureBlendMode(texture.get(), SDL_BLENDMODE_BLEND);
+	}
 public:
 	GPUImage(SDL_Renderer* renderer, const Image& baseImage) : Image{ baseImage } {
 		
@@ -76,22 +102,198 @@ public:
 		texture = {SDL_CreateTextureFromSurface(renderer, surf), SDL_DestroyTexture};
 
 		SDL_FreeSurface(surf);
+		prepare();
 
 		std::cout << "texture generated, ms: " << (std::clock() - now) / (double)(CLOCKS_PER_SEC / 1000) << std::endl;
 	};
 
+	/**
+	 * @brief Upload an already decoded image, e.g. one from the ImagePrefetcher.
+	 * 
+	 * @param renderer Renderer the texture will belong to.
+	 * @param baseImage The image the surface was decoded from.
+	 * @param surf Decoded image; ownership is taken, and it is freed once uploaded.
+	 */
+	GPUImage(SDL_Renderer* renderer, const Image& baseImage, SDL_Surface* surf) : Image{ baseImage } {
+		texture = {SDL_CreateTextureFromSurface(renderer, surf), SDL_DestroyTexture};
+		SDL_FreeSurface(surf);
+
+		if (texture == nullptr) {
+			std::string err = "Could not upload prefetched image " + path + "! SDL_Error: ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+		prepare();
+	};
+
 	SDL_Texture* getTexture() {
 		return texture.get();
 	}
+
+	std::size_t getByteSize() const {
+		return byteSize;
+	}
+
+	uint getWidth() const {
+		return width;
+	}
+
+	uint getHeight() const {
+		return height;
+	}
+};
+
+
+/**
+ * @brief Counters describing how well the TextureCache is doing.
+ */
+struct TextureCacheStats {
+	public:
+	std::size_t hits = 0;
+	std::size_t misses = 0;
+	std::size_t evictions = 0;
+	std::size_t residentBytes = 0;
+	std::size_t residentTextures = 0;
+};
+
+/**
+ * @brief Keeps GPU textures resident up to a byte budget, evicting the least recently used ones first.
+ * Pinned paths are never evicted, so the images of the frame on screen and the one after it stay put
+ * no matter how much else gets loaded. Pins may be set before the image is loaded.
+ * The budget is soft: if everything resident is pinned, the cache goes over rather than drop something in use.
+ */
+class TextureCache {
+	private:
+	struct Entry {
+		public:
+		GPUImage image;
+		// Position in lruOrder
+		std::list<std::string>::iterator lruPos;
+	};
+
+	std::unordered_map<std::string, Entry> entries;
+	// Most recently used at the front
+	std::list<std::string> lruOrder;
+	std::unordered_set<std::string> pinned;
+
+	std::size_t budget;
+	TextureCacheStats stats;
+
+	void touch(Entry& entry) {
+		lruOrder.splice(lruOrder.begin(), lruOrder, entry.lruPos);
+	}
+
+	// Evict from the cold end until back under budget, sparing pinned textures and the one just added
+	void evict(const std::string& keep) {
+		auto it = lruOrder.end();
+		while (stats.residentBytes > budget && it != lruOrder.begin()) {
+			--it;
+			if (*it == keep || pinned.contains(*it)) {
+				continue;
+			}
+			auto victim = entries.find(*it);
+			stats.residentBytes -= victim->second.image.getByteSize();
+			entries.erase(victim);
+			it = lruOrder.erase(it);
+			stats.evictions++;
+		}
+		stats.residentTextures = entries.size();
+	}
+
+	public:
+	/**
+	 * @brief Construct a new TextureCache.
+	 * 
+	 * @param budget Bytes of texture memory to stay within, pinned textures permitting.
+	 */
+	TextureCache(std::size_t budget = 256 * 1024 * 1024) : budget{budget} {};
+
+	bool contains(const std::string& path) const {
+		return entries.contains(path);
+	}
+
+	/**
+	 * @brief Look up a texture, marking it as recently used. Returns nullptr on a miss.
+	 * The pointer is valid until the next insert().
+	 */
+	GPUImage* find(const std::string& path) {
+		auto it = entries.find(path);
+		if (it == entries.end()) {
+			stats.misses++;
+			return nullptr;
+		}
+		stats.hits++;
+		touch(it->second);
+		return &it->second.image;
+	}
+
+	/**
+	 * @brief Add a texture, evicting others if that puts the cache over budget.
+	 * Replaces any texture already cached under the same path.
+	 */
+	GPUImage& insert(const std::string& path, GPUImage image) {
+		if (auto it = entries.find(path); it != entries.end()) {
+			stats.residentBytes -= it->second.image.getByteSize();
+			lruOrder.erase(it->second.lruPos);
+			entries.erase(it);
+		}
+
+		lruOrder.push_front(path);
+		stats.residentBytes += image.getByteSize();
+		auto [it, _] = entries.emplace(path, Entry{std::move(image), lruOrder.begin()});
+
+		evict(path);
+		return it->second.image;
+	}
+
+	/**
+	 * @brief Replace the set of pinned paths.
+	 */
+	void pin(std::unordered_set<std::string> paths) {
+		pinned = std::move(paths);
+		evict({});
+	}
+
+	/**
+	 * @brief Change the budget, evicting straight away if it shrank.
+	 */
+	void setBudget(std::size_t bytes) {
+		budget = bytes;
+		evict({});
+	}
+
+	std::size_t getBudget() const {
+		return budget;
+	}
+
+	const TextureCacheStats& getStats() const {
+		return stats;
+	}
+
+	void resetStats() {
+		stats.hits = 0;
+		stats.misses = 0;
+		stats.evictions = 0;
+	}
 };
 
 class Renderer {
 	private:
 	std::shared_ptr<SDL_Renderer> renderer;
-	std::unordered_map<std::string, GPUImage> textureMap;
+	TextureCache textures;
+	// Output size only changes when the window does, so it's asked for once and kept until invalidateOutputSize()
+	std::optional<AbsoluteDimensions> outputSize;
+	// Background and characters, composed once and reused until either of them changes
+	std::shared_ptr<SDL_Texture> scene;
+	AbsoluteDimensions sceneDims = {0, 0};
 
 	public:
-	Renderer(SDL_Window* window) : renderer{ SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE), SDL_DestroyRenderer} {
+	/**
+	 * @brief Construct a new Renderer for a window.
+	 * 
+	 * @param window Window to render to.
+	 * @param textureBudget Bytes of texture memory the image cache may use.
+	 */
+	Renderer(SDL_Window* window, std::size_t textureBudget = 256 * 1024 * 1024) : renderer{ SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC | SDL_RENDERER_TARGETTEXTURE), SDL_DestroyRenderer}, textures{textureBudget} {
 		if (renderer.get() == nullptr) {
 			std::string err = "Renderer could not be created! SDL_Error: ";
 			throw std::runtime_error(err.append(SDL_GetError()));
@@ -100,28 +302,86 @@ class Renderer {
 	
 	Renderer() = default;
 
-	GPUImage& getImage(Image& image) {
-		if (textureMap.contains(image.path)) {
-			return textureMap.at(image.path);
+	GPUImage& getImage(const Image& image) {
+		if (GPUImage* cached = textures.find(image.path)) {
+			return *cached;
 		}
-		textureMap.insert({ image.path, {renderer.get(), image}});
-		return textureMap.at(image.path);
+		return textures.insert(image.path, {renderer.get(), image});
 	};
 
+	bool hasImage(const std::string& path) {
+		return textures.contains(path);
+	}
+
+	TextureCache& getTextureCache() {
+		return textures;
+	}
+
+	/**
+	 * @brief Turn any images the prefetcher has finished decoding into textures.
+	 * Cheap when there's nothing to collect, so it's fine to call once per loop iteration.
+	 */
+	void uploadPrefetched(ImagePrefetcher& prefetcher) {
+		prefetcher.collect([this](const std::string& path, SDL_Surface* surf) {
+			if (textures.contains(path)) {
+				// Loaded synchronously in the meantime
+				SDL_FreeSurface(surf);
+				return;
+			}
+			textures.insert(path, {renderer.get(), Image{path}, surf});
+		});
+	}
+
 	SDL_Renderer* getRenderer() {
 		return renderer.get();
 	}
 
 	AbsoluteDimensions getRendererDimensions() {
+		if (outputSize) {
+			return *outputSize;
+		}
+
 		int w, h;
 		if (SDL_GetRendererOutputSize(renderer.get(), &w, &h)) {
 			std::string err = "Renderer size not available! SDL_Error: ";
 			throw std::runtime_error(err.append(SDL_GetError()));
 		}
 
-		return { static_cast<uint>(w), static_cast<uint>(h) };
+		outputSize = { static_cast<uint>(w), static_cast<uint>(h) };
+		return *outputSize;
 	};
 
+	/**
+	 * @brief Forget the cached output size. Call whenever the window is resized.
+	 */
+	void invalidateOutputSize() {
+		outputSize.reset();
+	}
+
+	/**
+	 * @brief Make sure the scene texture exists and matches the output size.
+	 * 
+	 * @return Whether it was just (re)created, in which case its contents are undefined and it has to be redrawn.
+	 */
+	bool prepareScene() {
+		AbsoluteDimensions output = getRendererDimensions();
+		if (scene != nullptr && output.w == sceneDims.w && output.h == sceneDims.h) {
+			return false;
+		}
+
+		scene.reset(SDL_CreateTexture(renderer.get(), SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, output.w, output.h), SDL_DestroyTexture);
+		if (scene == nullptr) {
+			std::string err = "Scene texture could not be created! SDL_Error: ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+		sceneDims = output;
+		return true;
+	}
+
+	SDL_Texture* getScene() {
+		return scene.get();
+	}
+
 	/**
 	* @brief Renders an Image at a specified position.
 	*
@@ -130,27 +390,21 @@ class Renderer {
 	* @param scale_percentage Percentage points to scale the source by before rendering.
 	* @return The return status code of the underlying SDL_RenderCopy function.
 	*/
-	int renderImage(Image src, PositionMapping posMap, uint scale_percentage) {
+	int renderImage(const Image& src, const PositionMapping& posMap, uint scale_percentage) {
 
 		// The SDL gods demand a position sacrifice
 		SDL_Rect pos;
 
-		// Query image in cache
-		GPUImage image = getImage(src);
-
-		// Get texture width and height
-		int w, h;
-		SDL_QueryTexture(image.getTexture(), nullptr, nullptr, &w, &h);
-
-		SDL_SetTextureBlendMode(image.getTexture(), SDL_BLENDMODE_BLEND);
+		// Query image in cache; its dimensions and blend mode were settled when it was loaded
+		GPUImage& image = getImage(src);
 
 		// Convenience variables
-		uint srcTextureWidth = w;
-		uint srcTextureHeight = h;
+		uint srcTextureWidth = image.getWidth();
+		uint srcTextureHeight = image.getHeight();
 
-		SDL_GetRendererOutputSize(renderer.get(), &w, &h);
-		uint rendererWidth = w;
-		uint rendererHeight = h;
+		AbsoluteDimensions output = getRendererDimensions();
+		uint rendererWidth = output.w;
+		uint rendererHeight = output.h;
 
 		// Create both ratios now, to enable easier comparison with the later src ratios
 		double destWidthDivHeightRatio = static_cast<double>(rendererWidth) / static_cast<double>(rendererHeight);
@@ -200,7 +454,7 @@ class Renderer {
 		pos.y = xy.y;
 
 
-		return SDL_RenderCopyEx(renderer.get(), image.getTexture(), nullptr, &pos, 0, nullptr, SDL_FLIP_NONE);
+		return SDL_RenderCopy(renderer.get(), image.getTexture(), nullptr, &pos);
 	};
 
 
@@ -252,6 +506,11 @@ public:
 	};
 
 	~GPURenderManager() {
+		// One summary of how the texture cache did over the whole run
+		const TextureCacheStats& stats = renderer.getTextureCache().getStats();
+		std::cout << "texture cache: " << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions, "
+			<< stats.residentTextures << " textures in " << stats.residentBytes / 1024 << " KiB" << std::endl;
+
 		// Unload font support
 		TTF_Quit();
 
@@ -290,8 +549,12 @@ public:
 
 
 
-void renderText(TextRenderer& textRenderer, GPURenderManager& renderManager, Dialogue dialogue, DialogueFont font) {
-	textRenderer.renderStoryFrame(dialogue, font);
+void renderText(TextRenderer& textRenderer, GPURenderManager& renderManager, Dialogue dialogue, DialogueFont font, bool textChanged,
+                const ChapterLayout* chapterLayout, std::size_t frame) {
+	// Rasterising is the expensive part, and only needed when the dialogue itself changed; scrolling just moves the visible window
+	if (textChanged) {
+		textRenderer.renderStoryFrame(dialogue, font, chapterLayout, frame);
+	}
 	// hack
 	AbsoluteDimensions d = renderManager.getScreenDimensions();
 	textRenderer.displayText({.x = 0, .y = static_cast<int>(0.75 * d.h)});
@@ -299,7 +562,11 @@ void renderText(TextRenderer& textRenderer, GPURenderManager& renderManager, Dia
 };
 
 
-void renderFrame(GPURenderManager& SDLInfo, Frame& curFrame, TextRenderer& textRenderer) {
+/**
+ * @brief Bring the screen up to date with the current frame.
+ * Only the layers marked in damage are redrawn, and with nothing marked, nothing is drawn or presented at all.
+ */
+void renderFrame(GPURenderManager& SDLInfo, Chapter& chapter, TextRenderer& textRenderer, Damage damage = Damage::all()) {
 	/* Render loop:
 	   	
 		Background - x
@@ -325,43 +592,75 @@ void renderFrame(GPURenderManager& SDLInfo, Frame& curFrame, TextRenderer& textR
 			
 	*/
 
+	if (!damage.any()) {
+		return;
+	}
+
+	Frame curFrame = *chapter.curFrame;
+	Character& character = chapter.getCharacter(curFrame);
+
 	Renderer& renderer = SDLInfo.getWindowRenderer();
 
+	// A fresh scene texture has nothing in it yet
+	if (renderer.prepareScene()) {
+		damage.mark(Layer::background);
+		damage.mark(Layer::character);
+	}
 
+	// Background and characters share the scene texture, so a change to either redraws both
+	if (damage.has(Layer::background) || damage.has(Layer::character)) {
+		// Keep this frame's and the next frame's images resident however much else has been loaded
+		std::unordered_set<std::string> pins = {chapter.getBackground(curFrame).path, chapter.getExpression(curFrame).path};
+		if (auto next = chapter.curFrame + 1; next != chapter.storyFrames.end()) {
+			Frame nextFrame = *next;
+			pins.insert(chapter.getBackground(nextFrame).path);
+			pins.insert(chapter.getExpression(nextFrame).path);
+		}
+		renderer.getTextureCache().pin(std::move(pins));
 
-	// Background
-	std::cout << "background" << std::endl;
+		SDL_SetRenderTarget(renderer.getRenderer(), renderer.getScene());
 
-	SDL_SetRenderDrawColor(renderer.getRenderer(), 0, 0, 0, SDL_ALPHA_OPAQUE);
-	
+		// Background
+		std::cout << "background" << std::endl;
 
-	SDL_RenderClear(renderer.getRenderer());
+		SDL_SetRenderDrawColor(renderer.getRenderer(), 0, 0, 0, SDL_ALPHA_OPAQUE);
+		SDL_RenderClear(renderer.getRenderer());
 
-	PositionMapping posMap = {
-		.srcPos = {0.5, 0.5},
-		.destPos = {0.5, 0.5},
-	};
-	
-	if (renderer.renderImage(curFrame.bg, posMap, 100)) {
-		std::string err = "SDL error! Error string is ";
-		throw std::runtime_error(err.append(SDL_GetError()));
+		PositionMapping posMap = {
+			.srcPos = {0.5, 0.5},
+			.destPos = {0.5, 0.5},
+		};
+		
+		if (renderer.renderImage(chapter.getBackground(curFrame), posMap, 100)) {
+			std::string err = "SDL error! Error string is ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+
+		// Characters
+		std::cout << "characters" << std::endl;
+		// TODO: custom expression handlers 
+		if (renderer.renderImage(chapter.getExpression(curFrame), curFrame.position, 80)) {
+			std::string err = "SDL error! Error string is ";
+			throw std::runtime_error(err.append(SDL_GetError()));
+		}
+
+		SDL_SetRenderTarget(renderer.getRenderer(), nullptr);
 	}
 
-	// Characters
-	std::cout << "characters" << std::endl;
-	// TODO: custom expression handlers 
-	if (renderer.renderImage(curFrame.storyCharacter.expressions.at(curFrame.expression), curFrame.position, 80)) {
+	// The back buffer's contents are undefined after a present, so the layers are always composed onto it again.
+	// That's only a couple of copies from textures that are already up to date.
+	if (SDL_RenderCopy(renderer.getRenderer(), renderer.getScene(), nullptr, nullptr)) {
 		std::string err = "SDL error! Error string is ";
 		throw std::runtime_error(err.append(SDL_GetError()));
 	}
 	
 	// Text
 	std::cout << "text" << std::endl;
-	renderText(textRenderer, SDLInfo, {curFrame.storyCharacter.name, curFrame.textDialogue, {255, 255, 255}}, {"assets/fonts/BonaNova-Italic.ttf"});
+	renderText(textRenderer, SDLInfo, {character.name, std::string{curFrame.textDialogue}, {255, 255, 255}}, {dialogueFontPath}, damage.has(Layer::text),
+	           chapter.dialogueLayout.get(), chapter.curFrame.getIndex());
 	
 	std::cout << "flip buffers" << std::endl;
 	SDL_RenderPresent(renderer.getRenderer());
-
 }
 
 
@@ -0,0 +1,199 @@
+module;
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_surface.h>
+#include <SDL2/SDL_image.h>
+
+#include "structures.h"
+#include "schedule.h"
+
+
+export module ImagePrefetch;
+
+import Chapter;
+import Image;
+
+
+export namespace vnpge {
+
+/**
+ * @brief Decodes images on worker threads ahead of when they're needed.
+ * Textures can only be created on the render thread, so workers stop at a decoded SDL_Surface;
+ * the render thread picks those up with collect() and uploads them.
+ */
+class ImagePrefetcher {
+	private:
+	std::mutex mutex;
+	std::condition_variable wakeup;
+
+	// Paths waiting for a worker
+	std::deque<std::string> requests;
+	// Paths that are queued, being decoded or decoded but not yet collected, so they aren't requested twice
+	std::unordered_set<std::string> pending;
+	// Decoded images, waiting for the render thread. Lock-free, so checking for them costs the render thread next to nothing
+	MPSCSchedule<std::pair<std::string, SDL_Surface*>, 64> ready;
+
+	bool stopping = false;
+
+	// Declared last, so the workers are joined before anything they use is destroyed
+	std::vector<std::jthread> workers;
+
+	void work() {
+		while (true) {
+			std::string path;
+			{
+				std::unique_lock lock{mutex};
+				wakeup.wait(lock, [this] { return stopping || !requests.empty(); });
+				if (stopping) {
+					return;
+				}
+				path = std::move(requests.front());
+				requests.pop_front();
+			}
+
+			// File read and decode; the slow part, and the reason this thread exists
+			SDL_Surface* surf = IMG_Load(path.c_str());
+
+			// Convert to the renderer's preferred layout while still off the render thread, so upload is a plain copy
+			if (surf != nullptr && surf->format->format != SDL_PIXELFORMAT_ARGB8888) {
+				SDL_Surface* converted = SDL_ConvertSurfaceFormat(surf, SDL_PIXELFORMAT_ARGB8888, 0);
+				SDL_FreeSurface(surf);
+				surf = converted;
+			}
+
+			if (surf == nullptr) {
+				// Leave it to the synchronous path to load it again and report the error properly
+				std::cout << "Could not prefetch " << path << ": " << IMG_GetError() << std::endl;
+				std::lock_guard lock{mutex};
+				pending.erase(path);
+				continue;
+			}
+
+			// A failed enqueue leaves the image as it was, so it can simply be tried again once the render thread catches up
+			std::pair<std::string, SDL_Surface*> image = {std::move(path), surf};
+			while (!ready.enqueue(std::move(image))) {
+				{
+					std::lock_guard lock{mutex};
+					if (stopping) {
+						SDL_FreeSurface(surf);
+						return;
+					}
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+		}
+	}
+
+	public:
+	/**
+	 * @brief Construct a new ImagePrefetcher and start its workers.
+	 *
+	 * @param threadCount Number of decoding threads.
+	 */
+	ImagePrefetcher(uint threadCount = 2) {
+		workers.reserve(threadCount);
+		for (uint i = 0; i < threadCount; i++) {
+			workers.emplace_back([this] { work(); });
+		}
+	};
+
+	ImagePrefetcher(const ImagePrefetcher&) = delete;
+
+	~ImagePrefetcher() {
+		{
+			std::lock_guard lock{mutex};
+			stopping = true;
+		}
+		wakeup.notify_all();
+
+		for (auto& worker : workers) {
+			worker.join();
+		}
+
+		while (ready.isValid()) {
+			SDL_FreeSurface(ready.get().second);
+			ready.next();
+		}
+	};
+
+	/**
+	 * @brief Queue an image for decoding, unless it's already on its way.
+	 */
+	void request(const std::string& path) {
+		{
+			std::lock_guard lock{mutex};
+			if (!pending.insert(path).second) {
+				return;
+			}
+			requests.push_back(path);
+		}
+		wakeup.notify_one();
+	}
+
+	/**
+	 * @brief Queue the backgrounds and expressions of the frames following the current one.
+	 * Requests are made in frame order, so the nearest frames are decoded first.
+	 *
+	 * @param chapter Chapter whose curFrame is the cursor to look ahead of.
+	 * @param lookahead How many frames past the current one to prefetch for.
+	 * @param isLoaded Predicate telling whether the renderer already has an image, so it isn't decoded again.
+	 */
+	void prefetch(Chapter& chapter, uint lookahead, const std::function<bool(const std::string&)>& isLoaded) {
+		auto end = chapter.storyFrames.end();
+		if (end - chapter.curFrame > static_cast<std::ptrdiff_t>(lookahead) + 1) {
+			end = chapter.curFrame + lookahead + 1;
+		}
+
+		for (auto it = chapter.curFrame; it != end; ++it) {
+			Frame frame = *it;
+			for (Image* image : {&chapter.getBackground(frame), &chapter.getExpression(frame)}) {
+				if (!isLoaded(image->path)) {
+					request(image->path);
+				}
+			}
+		}
+	}
+
+	/**
+	 * @brief Whether any requested images have yet to be collected.
+	 * An event-driven loop should wake up now and then while this holds, to upload them.
+	 */
+	bool busy() {
+		std::lock_guard lock{mutex};
+		return !pending.empty();
+	}
+
+	/**
+	 * @brief Hand over all images decoded since the last call. Only to be called from one thread.
+	 * Takes no lock unless there's something to hand over.
+	 * 
+	 * @param take Called with each image's path and surface; it takes ownership of the surface.
+	 */
+	void collect(const std::function<void(const std::string&, SDL_Surface*)>& take) {
+		while (ready.isValid()) {
+			// Off the queue before handing over, so a throwing take() can't leave it there to be taken twice
+			std::string path = std::move(ready.get().first);
+			SDL_Surface* surf = ready.get().second;
+			ready.next();
+			{
+				std::lock_guard lock{mutex};
+				pending.erase(path);
+			}
+			take(path, surf);
+		}
+	}
+};
+
+};
@@ -2,8 +2,11 @@ module;
 #include <SDL2/SDL_render.h>
 #include <limits>
 #include <memory>
+#include <span>
 #include <stdexcept>
 #include <functional>
+#include <string>
+#include <unordered_map>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_surface.h>
@@ -18,6 +21,9 @@ module;
 #include "video-sdl-common.h"
 
 #include "structures.h"
+#include "font-cache.h"
+#include "text-layout.h"
+#include "chapter-layout.h"
 
 
 export module SoftwareText;
@@ -27,25 +33,6 @@ import StoryDialogue;
 
 export namespace vnpge {
 
-	class SWFont : DialogueFont {
-	private:
-	std::shared_ptr<TTF_Font> font;
-
-	public:
-	SWFont(DialogueFont& dfont, uint ptSize) : DialogueFont(dfont) {
-		float hdpi, vdpi;
-		SDL_GetDisplayDPI(0, nullptr, &hdpi, &vdpi);
-		font = {TTF_OpenFontDPI(dfont.getName().c_str(), ptSize, hdpi, vdpi), TTF_CloseFont };
-	};
-
-	SWFont() = default;
-	TTF_Font* getFont() {
-		return font.get();
-	}
-
-	~SWFont() {};
-	};
-
 class TextBoxInfo {
 	private:
 	AbsoluteDimensions resolution;
@@ -64,59 +51,6 @@ class TextBoxInfo {
 };
 
 
-class FontStorage {
-	private:
-	std::unordered_map<std::string, vnpge::SWFont> fontMap;
-	static uint getPtSize(const AbsoluteDimensions& boxDims) {
-		double boxHeight = static_cast<double>(boxDims.h) * 0.25;
-		uint ptSize;
-		uint numLines = 5;
-
-		// TODO: Evaluate pixel values based on DPI
-
-		while (boxHeight > 20) {
-			ptSize = boxHeight / numLines;
-			std::cout << "ptSize: " << ptSize << std::endl;
-			if (ptSize > 30) {
-				numLines += 1;
-				continue;
-			}
-			if (ptSize < 10) {
-				numLines -= 1;
-				continue;
-			}
-
-			if (boxHeight / (numLines + 1) < 25) {
-				std::cout << "boxheight: " << boxHeight << ", numLines: " << numLines << std::endl;
-				break;
-			}
-			else {
-				numLines += 1;
-			}
-		}
-		numLines += static_cast<uint>(boxDims.h / boxDims.w);
-		
-
-		return static_cast<uint>(std::round(static_cast<double>(boxHeight) / static_cast<double>(numLines))) * 3;
-	}
-	public:
-	SWFont operator() (DialogueFont font, const AbsoluteDimensions& boxDims ) {
-		if (!fontMap.contains(font.getName())) {
-			fontMap.insert({font.getName(), {font, getPtSize(boxDims)}});
-		}
-		return fontMap.at(font.getName());
-	}
-
-	void clear() {
-		fontMap.clear();
-	}
-};
-
-
-
-
-
-
 /**
  * @brief Stateful renderer for textboxes
  * 
@@ -133,13 +67,21 @@ class TextRenderer {
 
 	int scrolledLines = 0;
 	int lineHeight;
+	// Height of all of the text, going by its line count rather than the surface it was drawn on
+	int textHeight = 0;
 
-	FontStorage fontStorage;
+	// Glyph measurements for the shared line breaker, one per font
+	std::unordered_map<std::string, std::unique_ptr<AdvanceTable>> advanceTables;
 
 	// Generated values, don't touch
 
 	AbsoluteDimensions textArea;
 	AbsolutePosition textPosition; // origin is at upper left of background
+
+	// Fonts come from the process-wide cache, sized to fit the text box, so this is a lookup unless the size is new
+	SDLFont getFont(DialogueFont font) {
+		return openFont(font.getName(), dialoguePtSize(textArea));
+	}
 	
 	public:
 	TextRenderer(SDL_Surface* dest, TextBoxInfo boxInfo, TextBGCreator<SDL_Surface*> bgCreator,
@@ -148,7 +90,13 @@ class TextRenderer {
 		renderStoryFrame(dialogue, font);
 	};
 	
-	SDL_Surface* renderStoryFrame(Dialogue dialogue, DialogueFont font) {
+	/**
+	 * @brief Draw new dialogue.
+	 *
+	 * @param chapterLayout Line breaks worked out ahead of time, used if they're for this font and size; may be null.
+	 * @param frame Index of the dialogue's frame within chapterLayout.
+	 */
+	SDL_Surface* renderStoryFrame(Dialogue dialogue, DialogueFont font, const ChapterLayout* chapterLayout = nullptr, std::size_t frame = 0) {
 
 		// Grab dialogue colour
 		SDL_Color fgcolour = {
@@ -159,17 +107,35 @@ class TextRenderer {
 		};
 
 		// Look up font in font table
-		SWFont f = fontStorage(font, textArea);
+		SDLFont f = getFont(font);
+
+		// Grab the line height of the text, for scrolling purposes
+		lineHeight = TTF_FontLineSkip(f.getFont());
+
+		// Break the lines the same way the other backends do, and have SDL_ttf only wrap at the newlines that leaves (wrap length 0).
+		// If the whole chapter has been laid out already, the breaks are just looked up
+		std::string dialogueText = dialogue.getText();
+		std::string wrapped;
+		if (chapterLayout != nullptr && chapterLayout->matches(getLayoutFontKey(font), getWrapWidth())) {
+			wrapped = insertLineBreaks(dialogueText, chapterLayout->lineStarts(frame));
+			textHeight = static_cast<int>(chapterLayout->lineCount(frame)) * lineHeight;
+		}
+		else {
+			auto& advances = advanceTables[font.getName()];
+			if (advances == nullptr) {
+				advances = std::make_unique<AdvanceTable>(measureAdvances(f), measureKerning(f), static_cast<float>(lineHeight));
+			}
+			ParagraphLayout layout = layoutParagraph(dialogueText, *advances, getWrapWidth());
+			wrapped = insertLineBreaks(dialogueText, layout);
+			textHeight = static_cast<int>(layout.lineCount()) * lineHeight;
+		}
 
 		// Temporary storage for the complete text
-		SDL_Surface* renderedText = TTF_RenderUTF8_Blended_Wrapped(f.getFont(), dialogue.getText().c_str(), fgcolour, textArea.w);
+		SDL_Surface* renderedText = TTF_RenderUTF8_Blended_Wrapped(f.getFont(), wrapped.c_str(), fgcolour, 0);
 		
 		// Store the updated text
 		text.reset(renderedText, SDL_FreeSurface);
 
-		// Grab the line height of the text, for scrolling purposes
-		lineHeight = TTF_FontLineSkip(f.getFont());
-
 		return text.get();
 	};
 
@@ -184,9 +150,30 @@ class TextRenderer {
 		textArea = textBGSurface.second.area;
 		textPosition = textBGSurface.second.position;
 
-		fontStorage.clear();
+		// Tables were measured at the old size. Fonts are kept, so going back to an earlier size doesn't open the file again
+		advanceTables.clear();
 	};
 
+	/**
+	 * @brief Identifies a font at the size dialogue is currently drawn in, for matching a ChapterLayout against.
+	 */
+	std::string getLayoutFontKey(DialogueFont font) {
+		return font.getName() + '@' + std::to_string(dialoguePtSize(textArea));
+	}
+
+	float getWrapWidth() const {
+		return static_cast<float>(textArea.w);
+	}
+
+	/**
+	 * @brief Measurements of a font at the current size, for laying out a chapter off the render thread.
+	 * They go through a font of their own, as a TTF_Font can only be used by one thread at a time.
+	 */
+	std::shared_ptr<AdvanceTable> makeLayoutMetrics(DialogueFont font) {
+		SDLFont f = openUnsharedFont(font.getName(), dialoguePtSize(textArea));
+		return std::make_shared<AdvanceTable>(measureAdvances(f), measureKerning(f), static_cast<float>(TTF_FontLineSkip(f.getFont())));
+	}
+
 	void displayText(AbsolutePosition position) {
 		
 		SDL_Rect destPos = {
@@ -223,7 +210,7 @@ class TextRenderer {
 	 * 
 	 */
 	void scrollTextUp() {
-		if (static_cast<int>(textArea.h) < text->h && scrolledLines * lineHeight < text->h - textArea.h) {
+		if (static_cast<int>(textArea.h) < textHeight && scrolledLines * lineHeight < textHeight - static_cast<int>(textArea.h)) {
 			scrolledLines++;
 		}
 	};
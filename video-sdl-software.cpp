@@ -18,6 +18,8 @@ module;
 
 #include "structures.h"
 #include "schedule.h"
+#include "damage.h"
+#include "chapter-layout.h"
 
 
 export module SoftwareRender;
@@ -30,6 +32,9 @@ import SoftwareText;
 
 export namespace vnpge {
 
+// Font the dialogue is drawn in; also what chapter layouts have to be measured with
+inline constexpr char dialogueFontPath[] = "assets/fonts/BonaNova-Italic.ttf";
+
 template<typename T>
 void nullDeleter(T* surf) {
 };
@@ -210,8 +215,9 @@ int blitImageConstAspectRatio(SoftwareImage src, SoftwareImage dest, PositionMap
 
 
 
-void renderText(TextRenderer& textRenderer, SWRenderManager& renderManager, Dialogue dialogue, DialogueFont font) {
-	textRenderer.renderStoryFrame(dialogue, font);
+void renderText(TextRenderer& textRenderer, SWRenderManager& renderManager, Dialogue dialogue, DialogueFont font,
+                const ChapterLayout* chapterLayout, std::size_t frame) {
+	textRenderer.renderStoryFrame(dialogue, font, chapterLayout, frame);
 	// hack
 	AbsoluteDimensions d = renderManager.getScreenDimensions();
 	textRenderer.displayText({.x = 0, .y = static_cast<int>(0.75 * d.h)});
@@ -219,7 +225,12 @@ void renderText(TextRenderer& textRenderer, SWRenderManager& renderManager, Dial
 };
 
 
-void renderFrame(SWRenderManager& SDLInfo, Frame& curFrame, TextRenderer& textRenderer) {
+/**
+ * @brief Bring the screen up to date with the current frame.
+ * Skips drawing entirely when nothing is marked in damage. Otherwise everything is redrawn, since the text box is
+ * blended onto whatever is beneath it and so can't be redrawn on its own.
+ */
+void renderFrame(SWRenderManager& SDLInfo, Chapter& chapter, TextRenderer& textRenderer, Damage damage = Damage::all()) {
 	/* Render loop:
 	   	
 		Background - x
@@ -245,6 +256,13 @@ void renderFrame(SWRenderManager& SDLInfo, Frame& curFrame, TextRenderer& textRe
 			
 	*/
 
+	if (!damage.any()) {
+		return;
+	}
+
+	Frame curFrame = *chapter.curFrame;
+	Character& character = chapter.getCharacter(curFrame);
+
 	// Initial setup
 	SDL_Surface* screenSurface = SDLInfo.getScreenSurface();
 	SDL_Window* window = SDLInfo.getWindow();
@@ -262,7 +280,7 @@ void renderFrame(SWRenderManager& SDLInfo, Frame& curFrame, TextRenderer& textRe
 		.destPos = {0.5, 0.5},
 	};
 	
-	if (blitImageConstAspectRatio(SDLInfo.getImage(curFrame.bg), screen, posMap, 100)) {
+	if (blitImageConstAspectRatio(SDLInfo.getImage(chapter.getBackground(curFrame)), screen, posMap, 100)) {
 		std::string err = "SDL error! Error string is ";
 		throw std::runtime_error(err.append(SDL_GetError()));
 	}
@@ -270,14 +288,15 @@ void renderFrame(SWRenderManager& SDLInfo, Frame& curFrame, TextRenderer& textRe
 	// Characters
 	std::cout << "characters" << std::endl;
 	// TODO: custom expression handlers 
-	if (blitImageConstAspectRatio(SDLInfo.getImage(curFrame.storyCharacter.expressions.at(curFrame.expression)), screen, curFrame.position, 80)) {
+	if (blitImageConstAspectRatio(SDLInfo.getImage(chapter.getExpression(curFrame)), screen, curFrame.position, 80)) {
 		std::string err = "SDL error! Error string is ";
 		throw std::runtime_error(err.append(SDL_GetError()));
 	}
 	
 	// Text
 	std::cout << "text" << std::endl;
-	renderText(textRenderer, SDLInfo, {curFrame.storyCharacter.name, curFrame.textDialogue, {255, 255, 255}}, {"BonaNova-Italic.ttf"});
+	renderText(textRenderer, SDLInfo, {character.name, std::string{curFrame.textDialogue}, {255, 255, 255}}, {dialogueFontPath},
+	           chapter.dialogueLayout.get(), chapter.curFrame.getIndex());
 	
 	std::cout << "flip buffers" << std::endl;
 	SDL_UpdateWindowSurface(window);
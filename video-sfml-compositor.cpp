@@ -1,8 +1,23 @@
+#include <SFML/Graphics/Color.hpp>
 #include <SFML/Graphics/Rect.hpp>
+#include <SFML/Graphics/RectangleShape.hpp>
+#include <SFML/Graphics/RenderStates.hpp>
+#include <SFML/Graphics/RenderTexture.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
 #include <SFML/Graphics/View.hpp>
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <stdexcept>
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
 
 
 
@@ -18,26 +33,236 @@
 
 namespace vnpge {
 
-	SFMLCompositorArea::SFMLCompositorArea(const CompositorArea<SFMLRenderFunc>& area, std::string_view fId, AbsoluteDimensions targetPixelDims) : foreignId{fId}, area{ area } {
+	// Gap left between slots on a page, so that nothing sampled at the edge of one bleeds in from its neighbour
+	static constexpr uint slotPadding = 1;
 
-		target.create(area.area.dimensions.w * targetPixelDims.w, area.area.dimensions.h * targetPixelDims.h);
-		area.renderToTarget(target);
-		target.display();
-		sprite.setTexture(target.getTexture());
+	// Make a slot transparent again, without touching the rest of its page
+	static void clearSlot(const RenderSlot& slot) {
+		sf::RectangleShape clear{sf::Vector2f{static_cast<float>(slot.rect.width), static_cast<float>(slot.rect.height)}};
+		clear.setPosition(static_cast<float>(slot.rect.left), static_cast<float>(slot.rect.top));
+		clear.setFillColor(sf::Color::Transparent);
+		slot.page->setView(slot.page->getDefaultView());
+		slot.page->draw(clear, sf::RenderStates{sf::BlendNone});
+	}
+
+	RenderTargetPool::RenderTargetPool(uint pageSize) : pageSize{pageSize} {};
+
+	sf::Vector2u RenderTargetPool::sizeClass(sf::Vector2u size) {
+		auto roundUp = [](uint side) -> uint {
+			if (side <= 64) {
+				return 64;
+			}
+			uint step = std::bit_ceil(side) / 4;
+			return (side + step - 1) / step * step;
+		};
+		return {roundUp(size.x), roundUp(size.y)};
+	}
+
+	RenderTargetPool::Page& RenderTargetPool::pageOf(const RenderSlot& slot) {
+		return **std::find_if(pages.begin(), pages.end(), [&slot](const auto& page) { return page->texture.get() == slot.page; });
+	}
+
+	RenderSlot RenderTargetPool::acquire(sf::Vector2u size) {
+		sf::Vector2u classSize = sizeClass(size);
+		sf::Vector2i classDims{static_cast<int>(classSize.x), static_cast<int>(classSize.y)};
+
+		// Most recently released first, as its page is the likeliest to still be warm
+		auto it = std::find_if(free.rbegin(), free.rend(), [classDims](const RenderSlot& slot) {
+			return slot.rect.width == classDims.x && slot.rect.height == classDims.y;
+		});
+		if (it != free.rend()) {
+			RenderSlot slot = *it;
+			free.erase(std::next(it).base());
+			// Whatever its last user drew is still on it
+			clearSlot(slot);
+			pageOf(slot).live++;
+			reused++;
+			return slot;
+		}
+
+		// Find room for the slot on a page, starting a new shelf as needed; a page is left as it was if there isn't any
+		auto place = [classSize](Page& page) -> std::optional<sf::IntRect> {
+			sf::Vector2u pageDims = page.texture->getSize();
+			uint x = page.shelfX;
+			uint y = page.shelfY;
+			uint shelfHeight = page.shelfHeight;
+			if (x + classSize.x > pageDims.x) {
+				y += shelfHeight;
+				x = 0;
+				shelfHeight = 0;
+			}
+			if (x + classSize.x > pageDims.x || y + classSize.y > pageDims.y) {
+				return std::nullopt;
+			}
+			page.shelfX = x + classSize.x + slotPadding;
+			page.shelfY = y;
+			page.shelfHeight = std::max(shelfHeight, classSize.y + slotPadding);
+			return sf::IntRect{static_cast<int>(x), static_cast<int>(y), static_cast<int>(classSize.x), static_cast<int>(classSize.y)};
+		};
+
+		std::optional<sf::IntRect> rect;
+		Page* page = nullptr;
+		for (auto& candidate : pages) {
+			if ((rect = place(*candidate))) {
+				page = candidate.get();
+				break;
+			}
+		}
+
+		if (page == nullptr) {
+			// Slots bigger than a page get a page of their own, just large enough
+			sf::Vector2u pageDims{std::max(pageSize, classSize.x), std::max(pageSize, classSize.y)};
+			auto texture = std::make_unique<sf::RenderTexture>();
+			if (!texture->create(pageDims.x, pageDims.y)) {
+				std::string err = "Error: Render target could not be created. Size: ";
+				throw std::runtime_error(err.append(std::to_string(pageDims.x)).append("x").append(std::to_string(pageDims.y)));
+			}
+			texture->clear(sf::Color::Transparent);
+			pages.push_back(std::make_unique<Page>(Page{.texture = std::move(texture)}));
+			page = pages.back().get();
+			rect = place(*page);
+		}
+
+		page->live++;
+		created++;
+		return {page->texture.get(), *rect};
+	}
+
+	void RenderTargetPool::release(const RenderSlot& slot) noexcept {
+		if (slot.page == nullptr) {
+			return;
+		}
+		pageOf(slot).live--;
+		try {
+			free.push_back(slot);
+		}
+		catch (...) {
+			// Only costs the slot's space on its page, until the page is trimmed
+		}
+	}
+
+	void RenderTargetPool::trim() {
+		free.clear();
+		std::erase_if(pages, [](const auto& page) { return page->live == 0; });
+	}
+
+	std::size_t RenderTargetPool::freeCount() const {
+		return free.size();
+	}
+
+	std::size_t RenderTargetPool::pageCount() const {
+		return pages.size();
+	}
+
+	std::uint64_t RenderTargetPool::getCreated() const {
+		return created;
+	}
+
+	std::uint64_t RenderTargetPool::getReused() const {
+		return reused;
+	}
+
+
+	// Size of an area in pixels; never 0, which a texture can't be
+	static sf::Vector2u areaPixelSize(const RelativeDimensions& dimensions, AbsoluteDimensions targetPixelDims) {
+		return {std::max(1u, static_cast<uint>(dimensions.w * targetPixelDims.w)), std::max(1u, static_cast<uint>(dimensions.h * targetPixelDims.h))};
+	}
+
+	// Point the page's view at the top left pixelSize pixels of the slot, so whatever's drawn fills just that
+	static void fitView(const RenderSlot& slot, sf::Vector2u pixelSize) {
+		sf::Vector2f size{static_cast<float>(pixelSize.x), static_cast<float>(pixelSize.y)};
+		sf::Vector2f pageSize{static_cast<float>(slot.page->getSize().x), static_cast<float>(slot.page->getSize().y)};
+		sf::View view{sf::FloatRect{0, 0, size.x, size.y}};
+		view.setViewport(sf::FloatRect{slot.rect.left / pageSize.x, slot.rect.top / pageSize.y, size.x / pageSize.x, size.y / pageSize.y});
+		slot.page->setView(view);
+	}
+
+
+	SFMLCompositorArea::SFMLCompositorArea(const CompositorArea<SFMLRenderFunc>& area, std::string_view fId, RenderTargetPool& pool, AbsoluteDimensions targetPixelDims)
+	: pool{&pool}, pixelSize{areaPixelSize(area.area.dimensions, targetPixelDims)}, foreignId{fId}, area{ area } {
+
+		slot = pool.acquire(pixelSize);
+		sprite.setTexture(slot.page->getTexture());
+		sprite.setTextureRect(getTextureRect());
+		render();
+		stats.redraws++;
+	};
+
+	SFMLCompositorArea::SFMLCompositorArea(SFMLCompositorArea&& a) noexcept
+	: pool{a.pool}, slot{std::exchange(a.slot, {})}, pixelSize{a.pixelSize}, sprite{std::move(a.sprite)}, foreignId{std::move(a.foreignId)},
+	  version{a.version}, renderedVersion{a.renderedVersion}, stats{a.stats}, area{std::move(a.area)} {
 	};
 
-	SFMLCompositorArea::SFMLCompositorArea(SFMLCompositorArea&& a) : area{ a.area } {}
+	SFMLCompositorArea::~SFMLCompositorArea() {
+		// Moved-from areas have nothing to give back
+		pool->release(slot);
+	}
+
+	bool SFMLCompositorArea::resize(AbsoluteDimensions targetPixelDims) {
+		sf::Vector2u newSize = areaPixelSize(area.area.dimensions, targetPixelDims);
+		if (newSize == pixelSize) {
+			return false;
+		}
+
+		sf::Vector2u classSize = RenderTargetPool::sizeClass(newSize);
+		if (static_cast<int>(classSize.x) != slot.rect.width || static_cast<int>(classSize.y) != slot.rect.height) {
+			// Acquired before the old one goes back, so a throw leaves the area as it was
+			RenderSlot replacement = pool->acquire(newSize);
+			pool->release(std::exchange(slot, replacement));
+			sprite.setTexture(slot.page->getTexture());
+		}
+		else {
+			clearSlot(slot);
+		}
+		pixelSize = newSize;
+		sprite.setTextureRect(getTextureRect());
+		invalidate();
+		return true;
+	}
 	
 
 
 	bool SFMLCompositorArea::shouldRender() const {
-		return area.shouldRender();
+		return area.shouldRender && area.shouldRender();
+	}
+
+	std::uint64_t SFMLCompositorArea::invalidate() {
+		return ++version;
+	}
+
+	std::uint64_t SFMLCompositorArea::getVersion() const {
+		return version;
+	}
+
+	bool SFMLCompositorArea::isStale() const {
+		return renderedVersion != version || shouldRender();
+	}
+
+	void SFMLCompositorArea::update() {
+		if (isStale()) {
+			render();
+			stats.redraws++;
+		}
+		else {
+			stats.reuses++;
+		}
 	}
 	
 	void SFMLCompositorArea::render() {
-		area.renderToTarget(target);
-		target.display();
+		// The page is shared, so its view may be pointing at some other area's slot
+		fitView(slot, pixelSize);
+		area.renderToTarget(*slot.page);
+		slot.page->display();
+		renderedVersion = version;
 	};
+
+	const AreaRenderStats& SFMLCompositorArea::getStats() const {
+		return stats;
+	}
+
+	void SFMLCompositorArea::resetStats() {
+		stats = {};
+	}
 	
 
 	std::string_view SFMLCompositorArea::getForeignId() const {
@@ -48,69 +273,172 @@ namespace vnpge {
 		return sprite;
 	}
 
+	const sf::Texture& SFMLCompositorArea::getTexture() const {
+		return slot.page->getTexture();
+	}
+
+	sf::Vector2u SFMLCompositorArea::getPixelSize() const {
+		return pixelSize;
+	}
+
+	sf::IntRect SFMLCompositorArea::getTextureRect() const {
+		return {slot.rect.left, slot.rect.top, static_cast<int>(pixelSize.x), static_cast<int>(pixelSize.y)};
+	}
+
 	
 	void SFMLCompositor::addArea(std::string_view id, std::string_view foreignId, const CompositorArea<SFMLRenderFunc>& area) {
-		areas.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(area, foreignId, targetPixelDims));
-		computeOrder();
+		layers.add(id, foreignId);
+		drawListValid = false;
+		try {
+			areas.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(area, foreignId, targets, targetPixelDims));
+		}
+		catch (...) {
+			layers.remove(id);
+			throw;
+		}
+	};
+
+	void SFMLCompositor::addAreas(const std::vector<SFMLAreaInsertion>& batch) {
+		std::vector<std::pair<std::string_view, std::string_view>> relations;
+		relations.reserve(batch.size());
+		for (const auto& insertion : batch) {
+			relations.emplace_back(insertion.id, insertion.foreignId);
+		}
+		// Checks the whole batch first, so nothing needs undoing if it throws
+		layers.add(relations);
+		drawListValid = false;
+
+		areas.reserve(areas.size() + batch.size());
+		try {
+			for (const auto& insertion : batch) {
+				areas.emplace(std::piecewise_construct, std::forward_as_tuple(insertion.id), std::forward_as_tuple(insertion.area, insertion.foreignId, targets, targetPixelDims));
+			}
+		}
+		catch (...) {
+			for (const auto& insertion : batch) {
+				removeArea(insertion.id);
+			}
+			throw;
+		}
 	};
 
-	void SFMLCompositor::removeArea(const std::string& id) {
-		areas.erase(id);
-		computeOrder();
+	void SFMLCompositor::removeArea(std::string_view id) {
+		drawListValid = false;
+		layers.remove(id, [this](std::string_view removed) {
+			if (auto it = areas.find(removed); it != areas.end()) {
+				areas.erase(it);
+			}
+		});
 	};
 
-	void SFMLCompositor::computeOrder() {
-		std::unordered_map<std::string_view, std::string_view> m;
-		for (auto& p : areas) {
-			m.emplace(p.first, p.second.getForeignId());
+	void SFMLCompositor::invalidate(std::string_view id) {
+		if (auto it = areas.find(id); it != areas.end()) {
+			it->second.invalidate();
 		}
-		
-		auto root = trees::buildTree(m, "vnpge::ui");
-		
-		order.clear();
-		auto& orderRef = order;
-		bfs(root, "", [&orderRef](const trees::OrderNode& n) {orderRef.push_back(n.id);});
+	}
 
+	const AreaRenderStats* SFMLCompositor::getStats(std::string_view id) const {
+		auto it = areas.find(id);
+		return it == areas.end() ? nullptr : &it->second.getStats();
 	}
 
-	void SFMLCompositor::render(sf::RenderTarget& dest) {
-		for (auto& area : areas) {
-			if (area.second.shouldRender()) {
-				area.second.render();
+	AreaRenderStats SFMLCompositor::getTotalStats() const {
+		AreaRenderStats total;
+		for (const auto& [id, area] : areas) {
+			total.redraws += area.getStats().redraws;
+			total.reuses += area.getStats().reuses;
+		}
+		return total;
+	}
+
+	void SFMLCompositor::resetStats() {
+		for (auto& [id, area] : areas) {
+			area.resetStats();
+		}
+	}
+
+	void SFMLCompositor::resize(AbsoluteDimensions size) {
+		targetPixelDims = size;
+		for (auto& [id, area] : areas) {
+			// A new size means new texture coordinates, if not a new texture
+			if (area.resize(size)) {
+				drawListValid = false;
 			}
 		}
+	}
+
+	const RenderTargetPool& SFMLCompositor::getTargetPool() const {
+		return targets;
+	}
+
+	void SFMLCompositor::computeOrder() {
+		layers.drawOrder();
+	}
+
+	const std::vector<std::string_view>& SFMLCompositor::getOrder() {
+		return layers.drawOrder();
+	}
+
+	void SFMLCompositor::buildDrawList(sf::Vector2u destSize) {
+		drawList.clear();
+		batches.clear();
+
+		for (std::string_view id : layers.drawOrder()) {
+			SFMLCompositorArea& area = areas.find(id)->second;
+			drawList.push_back(&area);
+
+			// Where the area goes, as a fraction of the destination: its destPos, less srcPos's share of its own size
+			const RelativeArea& rel = area.area.area;
+			float x0 = static_cast<float>((rel.position.destPos.x - rel.position.srcPos.x * rel.dimensions.w) * destSize.x);
+			float y0 = static_cast<float>((rel.position.destPos.y - rel.position.srcPos.y * rel.dimensions.h) * destSize.y);
+			float x1 = x0 + static_cast<float>(rel.dimensions.w * destSize.x);
+			float y1 = y0 + static_cast<float>(rel.dimensions.h * destSize.y);
 
-		for (auto& id : order) {
-			// ugly hack; there should be a workaround for this, but making it work first is top priority
-
-			// todo: clean up
-			// todo: support arbitrary root elements
-			if (id != "vnpge::ui") {
-				auto& area = areas.find(id)->second;
-				auto rectSize = area.getSprite().getTextureRect();
-				sf::FloatRect r = {static_cast<float>(rectSize.left), static_cast<float>(rectSize.top), static_cast<float>(rectSize.width), static_cast<float>(rectSize.height)};
-				
-				sf::View view{r};
-
-				auto getPos = [](RelativeArea relPos){
-					
-					auto x_k = relPos.position.destPos.x - (relPos.position.srcPos.x * relPos.dimensions.w);
-					auto y_k = relPos.position.destPos.y - (relPos.position.srcPos.y * relPos.dimensions.h);
-					return std::pair{x_k, y_k};
-				};
-
-				auto p = getPos(area.area.area);
-				
-				// 							x, y, w, h			
-				auto a = sf::FloatRect(p.first, p.second, area.area.area.dimensions.w, area.area.area.dimensions.h);
-				
-				view.setViewport(a);
-
-				dest.setView(view);
-				dest.draw(area.getSprite());
-				dest.setView(dest.getDefaultView());
+			// Only the area's own part of its page
+			const sf::Texture& texture = area.getTexture();
+			sf::IntRect rect = area.getTextureRect();
+			float u0 = static_cast<float>(rect.left);
+			float v0 = static_cast<float>(rect.top);
+			float u1 = static_cast<float>(rect.left + rect.width);
+			float v1 = static_cast<float>(rect.top + rect.height);
+
+			// Areas on the same page as the one below them join its batch
+			if (batches.empty() || batches.back().texture != &texture) {
+				batches.push_back({.texture = &texture});
 			}
+			sf::VertexArray& vertices = batches.back().vertices;
+			auto corner = [&vertices](float x, float y, float u, float v) {
+				vertices.append(sf::Vertex{sf::Vector2f{x, y}, sf::Vector2f{u, v}});
+			};
+			corner(x0, y0, u0, v0);
+			corner(x1, y0, u1, v0);
+			corner(x1, y1, u1, v1);
+			corner(x0, y0, u0, v0);
+			corner(x1, y1, u1, v1);
+			corner(x0, y1, u0, v1);
+		}
+
+		drawListSize = destSize;
+		drawListValid = true;
+	}
+
+	void SFMLCompositor::render(sf::RenderTarget& dest) {
+		if (!drawListValid || dest.getSize() != drawListSize) {
+			buildDrawList(dest.getSize());
+		}
+
+		// Only areas whose content changed are drawn again; the rest are composited from what's already in their targets
+		for (SFMLCompositorArea* area : drawList) {
+			area->update();
+		}
+
+		// Quads are in the destination's pixels, so everything is drawn through one view of exactly those, with one call per batch.
+		// Not the default view, which a window keeps at its original size when resized
+		sf::View previousView = dest.getView();
+		dest.setView(sf::View{sf::FloatRect{0, 0, static_cast<float>(drawListSize.x), static_cast<float>(drawListSize.y)}});
+		for (const DrawBatch& batch : batches) {
+			dest.draw(batch.vertices, sf::RenderStates{batch.texture});
 		}
-		
+		dest.setView(previousView);
 	}
-};
\ No newline at end of file
+};
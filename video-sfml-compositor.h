@@ -1,7 +1,15 @@
+#ifndef VNPGE_VIDEO_SFML_COMPOSITOR_HEADER
+#define VNPGE_VIDEO_SFML_COMPOSITOR_HEADER
+
 #include <SFML/Graphics/RenderTarget.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <string_view>
 
 
 
@@ -11,59 +19,296 @@
 #include "compositor.h"
 #include "structures.h"
 #include "trees.h"
+#include "util.h"
 #include "video-sfml.h"
 
 namespace vnpge {
-class SFMLCompositorArea {
+
+/**
+ * @brief How often an area's offscreen target was drawn again, and how often the last drawing was reused instead.
+ */
+struct AreaRenderStats {
+	public:
+	std::uint64_t redraws = 0;
+	std::uint64_t reuses = 0;
+};
+
+/**
+ * @brief Part of a shared render target that one area draws into.
+ */
+struct RenderSlot {
+	public:
+	sf::RenderTexture* page = nullptr;
+	// Where the slot is on its page; exactly as large as the size class it was handed out for
+	sf::IntRect rect;
+};
+
+/**
+ * @brief Offscreen render targets for compositor areas, handed out as slots on shared pages by size class and taken back for reuse.
+ * Areas that share a page can be composited with a single draw call, and areas that come and go (effects, menus)
+ * don't allocate a texture every time. Slots are packed into rows ("shelves") on each page, like glyphs in a glyph atlas;
+ * a slot too big for a page gets a page of its own.
+ * A slot is at least as large as what was asked for; its user draws into the top left corner of it through a view.
+ */
+class RenderTargetPool {
 	private:
-	RelativeArea area;
+	struct Page {
+		public:
+		std::unique_ptr<sf::RenderTexture> texture;
+		uint shelfX = 0;
+		uint shelfY = 0;
+		uint shelfHeight = 0;
+		// Slots handed out and not yet released
+		std::size_t live = 0;
+	};
+
+	// Behind pointers, so the textures stay put as pages come and go
+	std::vector<std::unique_ptr<Page>> pages;
+	// Released slots, oldest first
+	std::vector<RenderSlot> free;
+	uint pageSize;
+
+	std::uint64_t created = 0;
+	std::uint64_t reused = 0;
+
+	Page& pageOf(const RenderSlot& slot);
+
+	public:
+	/**
+	 * @param pageSize Length of a side of a shared page, in pixels.
+	 */
+	RenderTargetPool(uint pageSize = 2048);
+
+	RenderTargetPool(const RenderTargetPool&) = delete;
+
+	/**
+	 * @brief Size of the slots handed out for the given size.
+	 * Each side is rounded up to a quarter of the power of two above it, and to no less than 64 pixels,
+	 * so a slot wastes at most a quarter of each side, and nearby sizes share slots.
+	 */
+	static sf::Vector2u sizeClass(sf::Vector2u size);
 
-	sf::RenderTexture target;
+	/**
+	 * @brief A cleared slot of the size class for size: a released one if there is one, otherwise one packed onto a page.
+	 * Throws std::runtime_error if a new page is needed and can't be created.
+	 */
+	RenderSlot acquire(sf::Vector2u size);
+
+	/**
+	 * @brief Give a slot back for reuse.
+	 */
+	void release(const RenderSlot& slot) noexcept;
+
+	/**
+	 * @brief Forget released slots, and destroy every page that no slot in use is on.
+	 */
+	void trim();
+
+	std::size_t freeCount() const;
+
+	std::size_t pageCount() const;
+
+	/**
+	 * @brief Number of slots ever packed onto a page, and ever handed out again after being released.
+	 */
+	std::uint64_t getCreated() const;
+
+	std::uint64_t getReused() const;
+};
+
+
+/**
+ * @brief An area of the screen with an offscreen target of its own, which is kept until its content changes.
+ * Whoever owns the content calls invalidate() when it does, and the target is drawn again on the next render;
+ * otherwise the last drawing is reused. Areas with a shouldRender function are also drawn again whenever it returns true.
+ * The target is a slot on a page from a RenderTargetPool, and goes back to it when the area is destroyed.
+ * Render functions are handed the whole page through a view of just the area, so they should size what they draw by the view,
+ * not by the target itself, and must not clear() it; the area's part of the page is cleared for them whenever it's handed out or refitted.
+ */
+class SFMLCompositorArea {
+	private:
+	RenderTargetPool* pool;
+	// Empty in moved-from areas
+	RenderSlot slot;
+	// Part of the slot in use
+	sf::Vector2u pixelSize;
 	sf::Sprite sprite;
-	
+
 	std::string foreignId;
-	
+
+	// Bumped by every invalidate(); the target is up to date while renderedVersion matches it
+	std::uint64_t version = 0;
+	std::uint64_t renderedVersion = 0;
+	AreaRenderStats stats;
+
 	public:
+	CompositorArea<SFMLRenderFunc> area;
 
-	std::function<bool()> shouldRender;
+	SFMLCompositorArea(const CompositorArea<SFMLRenderFunc>& area, std::string_view fId, RenderTargetPool& pool, AbsoluteDimensions targetPixelDims);
 
-	std::function<void(sf::RenderTarget&)> renderToTarget;
-	SFMLCompositorArea(const RelativeArea& area, std::function<bool()> shouldRender, std::function<void(sf::RenderTarget&)> render) :
-		 area{area}, shouldRender{shouldRender}, renderToTarget{render} {};
-	
-	SFMLCompositorArea(const CompositorArea<SFMLRenderFunc>& area, std::string_view fId, AbsoluteDimensions targetPixelDims);
+	SFMLCompositorArea(SFMLCompositorArea&& a) noexcept;
 
-	SFMLCompositorArea(SFMLCompositorArea&& a);
-	
 	SFMLCompositorArea(const SFMLCompositorArea&) = delete;
 
+	~SFMLCompositorArea();
+
+	/**
+	 * @brief Fit the area to a new compositor size. Only takes another slot from the pool if the size class changes;
+	 * either way, the content is invalidated.
+	 *
+	 * @return Whether the area's size in pixels changed.
+	 */
+	bool resize(AbsoluteDimensions targetPixelDims);
+
+	bool shouldRender() const;
+
+	/**
+	 * @brief Mark the content as changed, so the target is drawn again on the next render.
+	 *
+	 * @return The content's new version.
+	 */
+	std::uint64_t invalidate();
+
+	std::uint64_t getVersion() const;
+
+	/**
+	 * @brief Whether the target no longer matches the content: it's been invalidated, or shouldRender says so.
+	 */
+	bool isStale() const;
+
+	/**
+	 * @brief Draw the target again if it's stale, and count whether it was redrawn or reused.
+	 */
+	void update();
+
+	void render();
+
+	const AreaRenderStats& getStats() const;
+
+	void resetStats();
+
 	std::string_view getForeignId() const;
 
 	const sf::Sprite& getSprite() const;
+
+	/**
+	 * @brief The page the area is drawn on, which other areas may share.
+	 */
+	const sf::Texture& getTexture() const;
+
+	/**
+	 * @brief Size of the area in pixels.
+	 */
+	sf::Vector2u getPixelSize() const;
+
+	/**
+	 * @brief The part of the page the area is drawn in.
+	 */
+	sf::IntRect getTextureRect() const;
+};
+
+
+/**
+ * @brief One area to add in a batch; see SFMLCompositor::addAreas.
+ */
+struct SFMLAreaInsertion {
+	public:
+	std::string id;
+	std::string foreignId;
+	CompositorArea<SFMLRenderFunc> area;
 };
 
 
 class SFMLCompositor {
 	private:
-	std::unordered_map<std::string, SFMLCompositorArea> areas;
+	/**
+	 * @brief A run of consecutive areas in draw order that are on the same page, drawn with one call.
+	 */
+	struct DrawBatch {
+		public:
+		const sf::Texture* texture;
+		// Two triangles per area, in the destination's pixels
+		sf::VertexArray vertices{sf::Triangles};
+	};
 
 	// todo: fix this mess
 	AbsoluteDimensions targetPixelDims;
-	
-	public:
-	std::vector<std::string> order;
 
-	
+	// Before areas, so that it outlives them; they give their slots back to it
+	RenderTargetPool targets;
+
+	std::unordered_map<std::string, SFMLCompositorArea, TransparentStringHash, std::equal_to<>> areas;
+
+	// Parent-child relations between areas, kept in draw order as areas come and go
+	trees::LayerGraph layers{"vnpge::ui"};
+
+	// Areas in draw order, and the geometry to draw them with. Areas stay put in the map, so the pointers are stable;
+	// the list is only rebuilt when areas are added, removed or resized, or the destination changes size
+	std::vector<SFMLCompositorArea*> drawList;
+	std::vector<DrawBatch> batches;
+	bool drawListValid = false;
+	sf::Vector2u drawListSize;
+
+	void buildDrawList(sf::Vector2u destSize);
+
 	public:
 
 	SFMLCompositor(AbsoluteDimensions size) : targetPixelDims{size} {};
 
+	/**
+	 * @brief Add an area on top of the area foreignId (or "vnpge::ui") and everything already on it.
+	 * Throws std::invalid_argument if the id is taken or foreignId doesn't exist.
+	 */
 	void addArea(std::string_view id, std::string_view foreignId, const CompositorArea<SFMLRenderFunc>& area);
 
-	void removeArea(const std::string& id);
+	/**
+	 * @brief Add many areas at once, in any order; an area's parent may come later in the batch.
+	 * The draw order is only worked out again once, rather than after every area.
+	 * If any area can't be added, none are.
+	 */
+	void addAreas(const std::vector<SFMLAreaInsertion>& batch);
+
+	/**
+	 * @brief Remove an area, and every area on it.
+	 */
+	void removeArea(std::string_view id);
+
+	/**
+	 * @brief Mark an area's content as changed, so it's drawn again on the next render. Unknown ids are ignored.
+	 */
+	void invalidate(std::string_view id);
 
+	/**
+	 * @brief Redraw and reuse counts for an area, or nullptr if there's no such area.
+	 */
+	const AreaRenderStats* getStats(std::string_view id) const;
+
+	/**
+	 * @brief Redraw and reuse counts over all areas together.
+	 */
+	AreaRenderStats getTotalStats() const;
+
+	void resetStats();
+
+	/**
+	 * @brief Change the size in pixels that areas are relative to, say when the window is resized.
+	 * Areas whose size in pixels changes are drawn again, and only those whose size class changes get another slot.
+	 */
+	void resize(AbsoluteDimensions size);
+
+	const RenderTargetPool& getTargetPool() const;
+
+	/**
+	 * @brief Bring the cached draw order up to date. Not needed before render(), which does it anyway.
+	 */
 	void computeOrder();
 
+	/**
+	 * @brief Ids of all areas, bottom first.
+	 */
+	const std::vector<std::string_view>& getOrder();
+
 	void render(sf::RenderTarget& dest);
-};	
 };
+};
+#endif
@@ -7,9 +7,11 @@
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/Graphics/Sprite.hpp>
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <ranges>
 #include <string>
 #include <stdexcept>
@@ -17,6 +19,8 @@
 #include <unordered_map>
 
 #include "structures.h"
+#include "font-cache.h"
+#include "text-layout.h"
 #include <SFML/Graphics/Font.hpp>
 #include <SFML/Graphics.hpp>
 
@@ -24,13 +28,27 @@
 
 namespace vnpge {
 
+	std::shared_ptr<const sf::Font> loadFont(const std::string& path) {
+		FontKey key = {.path = path};
+		return FontCache<const sf::Font>::global().get(key, [&](const std::shared_ptr<const MappedFile>& file) {
+			// The font reads glyphs from the mapping as it needs them, so it keeps the mapping alive
+			auto font = std::shared_ptr<sf::Font>{new sf::Font, [file](sf::Font* f) { delete f; }};
+			if (!font->loadFromMemory(file->data(), file->size())) {
+				std::string err = "Error: Font could not be loaded. Missing font file path: ";
+				throw std::runtime_error(err.append(path));
+			}
+			return font;
+		});
+	}
+
 
 	TextBox::TextBox(const std::string& dialogue, const std::string& fontName, std::pair<uint, uint> size, std::function<PositionedArea(sf::RenderTarget&)> createTextBG) {
 		background.create(size.first, size.second);
 
 		std::cout << background.getSize().x << std::endl;
 
-		text.setFont(fontStorage(fontName));
+		font = loadFont(fontName);
+		text.setFont(*font);
 		text.setStyle(sf::Text::Regular);
 		
 		// TODO: implement pixel size selection algorithm and story frame dependence
@@ -39,12 +57,12 @@ namespace vnpge {
 		// TODO: make this dependent on story frame
 		text.setFillColor(sf::Color(255, 255, 255, 255));
 		
-		auto area = createTextBG(background);
+		validTextSpace = createTextBG(background);
 		background.display();
 		
 		
 
-		text.setPosition(area.position.x, area.position.y);
+		text.setPosition(validTextSpace.position.x, validTextSpace.position.y);
 		
 		setWrappedString(dialogue);
 
@@ -61,6 +79,36 @@ namespace vnpge {
 
 	
 	void TextBox::setWrappedString(const std::string& dialogueString) {
+		if (advances == nullptr) {
+			bool bold = text.getStyle() & sf::Text::Bold;
+			advances = makeAdvanceTable(*text.getFont(), text.getCharacterSize(), bold);
+		}
+		text.setString(wrapText(dialogueString, *advances, static_cast<float>(validTextSpace.area.w)));
+	}
+
+
+	std::unique_ptr<AdvanceTable> makeAdvanceTable(const sf::Font& font, uint characterSize, bool bold) {
+		return std::make_unique<AdvanceTable>(
+			[&font, characterSize, bold](char32_t cp) { return font.getGlyph(cp, characterSize, bold).advance; },
+			[&font, characterSize](char32_t previous, char32_t cp) { return font.getKerning(previous, cp, characterSize); },
+			font.getLineSpacing(characterSize)
+		);
+	}
+
+
+	sf::String wrapText(const std::string& text, AdvanceTable& advances, float maxWidth) {
+		ParagraphLayout layout = layoutParagraph(text, advances, maxWidth);
+		std::string wrapped = insertLineBreaks(text, layout);
+		return sf::String::fromUtf8(wrapped.begin(), wrapped.end());
+	}
+
+
+	sf::String wrapText(const std::string& text, const sf::Font& font, uint characterSize, float maxWidth, bool bold) {
+		return wrapText(text, *makeAdvanceTable(font, characterSize, bold), maxWidth);
+	}
+
+
+	sf::String wrapTextRelayout(sf::Text& text, const std::string& dialogueString, float maxX) {
 
 		std::vector<uint> spacePositions;
 		
@@ -79,9 +127,43 @@ namespace vnpge {
 			
 			// BUG: this interacts poorly with multiple consecutive spaces
 			// TODO: test if this is true
-			if (charPos.x > validTextSpace.position.x + validTextSpace.area.w) {
+			if (charPos.x > maxX) {
 				wrappedString[spacePos] = '\n';
 			}
 		}
+		return sf::String::fromUtf8(wrappedString.begin(), wrappedString.end());
+	}
+
+
+	void benchmarkWrap(const sf::Font& font, uint characterSize, float maxWidth, const std::string& paragraph, uint repetitions) {
+		using clock = std::chrono::steady_clock;
+
+		sf::Text text;
+		text.setFont(font);
+		text.setCharacterSize(characterSize);
+
+		// Warm the font's glyph cache and the advance table, so neither side pays for rasterising glyphs
+		auto advances = makeAdvanceTable(font, characterSize);
+		sf::String reference = wrapText(paragraph, *advances, maxWidth);
+
+		auto start = clock::now();
+		for (uint i = 0; i < repetitions; i++) {
+			reference = wrapText(paragraph, *advances, maxWidth);
+		}
+		auto linear = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+
+		start = clock::now();
+		sf::String relayout;
+		for (uint i = 0; i < repetitions; i++) {
+			relayout = wrapTextRelayout(text, paragraph, maxWidth);
+		}
+		auto quadratic = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+
+		std::cout << "wrapping " << paragraph.size() << " bytes, " << repetitions << " times" << std::endl;
+		std::cout << "wrapText: " << linear.count() << " us, wrapTextRelayout: " << quadratic.count() << " us" << std::endl;
+		if (reference != relayout) {
+			// Expected wherever the line breaking rules differ from just breaking at spaces, and for non-ASCII text, which the old version indexes by byte
+			std::cout << "note: the two disagree on where to break" << std::endl;
+		}
 	}
 }
@@ -12,6 +12,7 @@
 #include <cstddef>
 #include <functional>
 #include <iostream>
+#include <memory>
 #include <ranges>
 #include <string>
 #include <stdexcept>
@@ -19,51 +20,59 @@
 #include <unordered_map>
 
 #include "structures.h"
+#include "font-cache.h"
+#include "text-layout.h"
 #include <SFML/Graphics/Font.hpp>
 #include <SFML/Graphics.hpp>
 
 namespace vnpge {
-class SFMLFont {
-	private:
-	std::string fontName;
-	sf::Font font;
-	
-	public:
-	SFMLFont(const std::string& fontPath) : fontName{fontPath} {
-		if (!font.loadFromFile(fontPath)) {
-			std::string err = "Error: Font could not be loaded. Missing font file path: ";
-			throw std::runtime_error(err.append(fontPath));
-		}
-	}
-	const sf::Font& getFont() const {
-		return font;
-	}
-};
-
-
-
-class SFMLFontStorage {
-	private:
-	std::unordered_map<std::string, SFMLFont> map;
-
-	public:
-	SFMLFontStorage() = default;
-	
-	const sf::Font& operator()(const std::string& fontName) {
-		if (!map.contains(fontName)) {
-			map.insert({fontName, SFMLFont{fontName}});
-		}
-		return map.at(fontName).getFont();
-	}
-};
-
+/**
+ * @brief Load a font through the process-wide FontCache, reading it from the shared mapping of its file.
+ * An sf::Font covers every character size, so there's one per file.
+ */
+std::shared_ptr<const sf::Font> loadFont(const std::string& path);
+
+
+
+/**
+ * @brief Build an AdvanceTable measuring glyphs the way sf::Text lays them out.
+ * The font has to outlive the table.
+ */
+std::unique_ptr<AdvanceTable> makeAdvanceTable(const sf::Font& font, uint characterSize, bool bold = false);
+
+/**
+ * @brief Insert line breaks into text so that no line is wider than maxWidth, using the shared line breaker.
+ * A single pass over the text, measuring each glyph's advance and kerning through the table's cache.
+ * 
+ * @param text UTF-8 text to wrap.
+ * @return The wrapped text, ready for sf::Text::setString.
+ */
+sf::String wrapText(const std::string& text, AdvanceTable& advances, float maxWidth);
+
+/**
+ * @brief Like the above, with a throwaway table; for one-off wrapping.
+ */
+sf::String wrapText(const std::string& text, const sf::Font& font, uint characterSize, float maxWidth, bool bold = false);
+
+/**
+ * @brief The old way of wrapping: lay the whole string out again for every space. Quadratic in the length of the text.
+ * Only kept around to benchmark wrapText against.
+ */
+sf::String wrapTextRelayout(sf::Text& text, const std::string& dialogueString, float maxX);
+
+/**
+ * @brief Time wrapText against wrapTextRelayout on the same paragraph and print the results.
+ */
+void benchmarkWrap(const sf::Font& font, uint characterSize, float maxWidth, const std::string& paragraph, uint repetitions);
 
 
 class TextBox {
 	private:
-	SFMLFontStorage fontStorage;
+	std::shared_ptr<const sf::Font> font;
 
 	sf::Text text;
+	// Glyph measurements for wrapping, for the text's font and size
+	std::unique_ptr<AdvanceTable> advances;
 
 	public:
 	sf::RenderTexture background;